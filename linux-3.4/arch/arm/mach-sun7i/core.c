@@ -39,6 +39,19 @@
 #include <asm/pgtable.h>
 #include <asm/hardware/gic.h>
 #include <linux/i2c.h>
+#include <linux/cpu.h>
+#include <linux/kernel_stat.h>
+#include <linux/hardirq.h>
+#include <linux/workqueue.h>
+#include <linux/tick.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/suspend.h>
+#include <linux/syscore_ops.h>
+#include <linux/usb.h>
+#include <linux/slab.h>
 
 #include <asm/hardware/cache-l2x0.h>
 #include <asm/mach/arch.h>
@@ -72,13 +85,136 @@ static void __init gic_init_irq(void)
 	gic_init(0, 29, (void *)IO_ADDRESS(AW_GIC_DIST_BASE), (void *)IO_ADDRESS(AW_GIC_CPU_BASE));
 }
 
+/*
+ * Each CPU must tick from its own arch timer. The SoC timer is global
+ * and, once replaced by the arch timer on CPU0, is only kept as the
+ * broadcast device for idle states that stop the arch timer. If a CPU
+ * ends up without a local timer it gets the dummy device and all of its
+ * ticks, NO_HZ idle wakeups included, arrive as broadcast IPIs. That
+ * is a setup bug, so it is only warned about.
+ */
+#if defined(CONFIG_SMP) && \
+	!(defined(CONFIG_LOCAL_TIMERS) && defined(CONFIG_ARM_ARCH_TIMER))
+#error "sun7i SMP needs LOCAL_TIMERS and ARM_ARCH_TIMER"
+#endif
+
+#define SUN7I_ARCH_TIMER_NAME	"arch_sys_timer"
+/* ipi_irqs[] slot of IPI_TIMER, the first IPI smp.c counts */
+#define SUN7I_IPI_TIMER_STAT	0
+
 static void __init sun7i_timer_init(void)
 {
+	int err;
+
 	aw_clkevt_init();
 	/* to fix, 2013-1-14 */
 	aw_clksrc_init();
-	arch_timer_common_register();
+	err = arch_timer_common_register();
+	if (err)
+		pr_err("%s: no arch timer (%d), CPUs will tick through "
+		       "broadcast\n", __func__, err);
+}
+
+/* a CPU ticking from anything but its own arch timer costs IPIs */
+static bool sun7i_tick_is_local(int cpu)
+{
+	struct clock_event_device *evt = tick_get_device(cpu)->evtdev;
+
+	return evt && !strcmp(evt->name, SUN7I_ARCH_TIMER_NAME)
+		&& cpumask_equal(evt->cpumask, cpumask_of(cpu));
+}
+
+static void sun7i_tick_check(int cpu)
+{
+	struct clock_event_device *evt = tick_get_device(cpu)->evtdev;
+
+	if (sun7i_tick_is_local(cpu))
+		return;
+
+	WARN(1, "cpu%d: ticks from %s, not its arch timer\n", cpu,
+	     evt ? evt->name : "nothing");
+}
+
+static int sun7i_tick_cpu_notify(struct notifier_block *nb,
+				 unsigned long action, void *hcpu)
+{
+	if (action == CPU_ONLINE)
+		sun7i_tick_check((long)hcpu);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block sun7i_tick_cpu_nb = {
+	.notifier_call	= sun7i_tick_cpu_notify,
+};
+
+#ifdef CONFIG_DEBUG_FS
+static int sun7i_tick_show(struct seq_file *m, void *unused)
+{
+	struct clock_event_device *evt;
+	int cpu;
+
+#ifdef CONFIG_GENERIC_CLOCKEVENTS_BROADCAST
+	evt = tick_get_broadcast_device()->evtdev;
+	if (evt)
+		seq_printf(m, "broadcast: %s events %u\n", evt->name,
+			   evt->irq >= 0 ? kstat_irqs(evt->irq) : 0);
+	else
+		seq_printf(m, "broadcast: none\n");
+	seq_printf(m, "broadcast_cpus: ");
+	seq_cpumask_list(m, tick_get_broadcast_mask());
+#ifdef CONFIG_TICK_ONESHOT
+	seq_printf(m, "\nbroadcast_oneshot_cpus: ");
+	seq_cpumask_list(m, tick_get_broadcast_oneshot_mask());
+#endif
+	seq_printf(m, "\n");
+#endif
+
+	for_each_online_cpu(cpu) {
+		evt = tick_get_device(cpu)->evtdev;
+		seq_printf(m, "cpu%d: %s local %s events %u", cpu,
+			   evt ? evt->name : "none",
+			   sun7i_tick_is_local(cpu) ? "y" : "n",
+			   evt && evt->irq >= 0 ? kstat_irqs_cpu(evt->irq, cpu)
+						: 0);
+#ifdef CONFIG_SMP
+		seq_printf(m, " timer_ipi %u",
+			   __get_irq_stat(cpu,
+					  ipi_irqs[SUN7I_IPI_TIMER_STAT]));
+#endif
+		seq_printf(m, "\n");
+	}
+	return 0;
+}
+
+static int sun7i_tick_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sun7i_tick_show, NULL);
+}
+
+static const struct file_operations sun7i_tick_fops = {
+	.owner		= THIS_MODULE,
+	.open		= sun7i_tick_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
+/* boot CPUs are up by now, later ones are checked as they come online */
+static int __init sun7i_tick_init(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		sun7i_tick_check(cpu);
+	register_cpu_notifier(&sun7i_tick_cpu_nb);
+#ifdef CONFIG_DEBUG_FS
+	debugfs_create_file("sun7i_tick", S_IRUGO, NULL, NULL,
+			    &sun7i_tick_fops);
+#endif
+	return 0;
 }
+late_initcall(sun7i_tick_init);
 
 static struct sys_timer sun7i_timer = {
 	.init		= sun7i_timer_init,
@@ -181,6 +317,456 @@ void sun7i_get_reserved_addr(struct __sun7i_reserved_addr *reserved_addr)
 }
 EXPORT_SYMBOL(sun7i_get_reserved_addr);
 
+#ifdef CONFIG_PM_SLEEP
+/*
+ * Super standby resume profiling.
+ * The resume path is split into phases by timestamps taken after the
+ * standby firmware has returned and CPU0 is restored (syscore resume),
+ * once the non-boot CPUs are back, at the end of the noirq and of the
+ * synchronous device resume (a marker device registered last), and
+ * after async resumes, complete and thaw (PM_POST_SUSPEND). The time
+ * spent asleep, firmware included, is only known from the persistent
+ * clock. I2C clients and USB devices additionally get their own resume
+ * callbacks timed, and the I2C clients known to depend on nothing but
+ * their adapter are resumed asynchronously.
+ */
+enum sun7i_resume_mark {
+	SUN7I_MARK_SYSCORE,
+	SUN7I_MARK_CPUS,
+	SUN7I_MARK_NOIRQ,
+	SUN7I_MARK_DEVICES,
+	SUN7I_MARK_POST,
+	SUN7I_MARK_NUM,
+};
+
+/* phase i lasts from mark i to mark i + 1, the last one is the total */
+static const char * const sun7i_resume_phase[SUN7I_MARK_NUM] = {
+	"cpus", "noirq", "devices", "finish", "total",
+};
+
+static struct {
+	ktime_t	sleep_at;	/* boottime */
+	ktime_t	mark[SUN7I_MARK_NUM];
+	u32	seen;
+	u32	cycles;
+	u32	sleep_ms;
+	u32	last_us[SUN7I_MARK_NUM];
+	u32	max_us[SUN7I_MARK_NUM];
+	u64	total_us[SUN7I_MARK_NUM];
+} sun7i_resume;
+
+static void sun7i_resume_mark(enum sun7i_resume_mark mark)
+{
+	sun7i_resume.mark[mark] = ktime_get();
+	sun7i_resume.seen |= BIT(mark);
+}
+
+static void sun7i_resume_account(void)
+{
+	u32 us;
+	int i;
+
+	if (sun7i_resume.seen != BIT(SUN7I_MARK_NUM) - 1)
+		return;
+
+	for (i = 0; i < SUN7I_MARK_NUM; i++) {
+		if (i == SUN7I_MARK_NUM - 1)
+			us = ktime_us_delta(sun7i_resume.mark[SUN7I_MARK_POST],
+					    sun7i_resume.mark[SUN7I_MARK_SYSCORE]);
+		else
+			us = ktime_us_delta(sun7i_resume.mark[i + 1],
+					    sun7i_resume.mark[i]);
+		sun7i_resume.last_us[i] = us;
+		sun7i_resume.total_us[i] += us;
+		if (us > sun7i_resume.max_us[i])
+			sun7i_resume.max_us[i] = us;
+	}
+	sun7i_resume.cycles++;
+
+	pr_debug("resume: %u us (cpus %u, noirq %u, devices %u, finish %u)\n",
+		 sun7i_resume.last_us[4], sun7i_resume.last_us[0],
+		 sun7i_resume.last_us[1], sun7i_resume.last_us[2],
+		 sun7i_resume.last_us[3]);
+}
+
+/* registered after timekeeping, so suspends before and resumes after it */
+static int sun7i_resume_syscore_suspend(void)
+{
+	sun7i_resume.seen = 0;
+	sun7i_resume.sleep_at = ktime_get_boottime();
+	return 0;
+}
+
+static void sun7i_resume_syscore_resume(void)
+{
+	sun7i_resume.sleep_ms = ktime_to_ms(ktime_sub(ktime_get_boottime(),
+						      sun7i_resume.sleep_at));
+	sun7i_resume_mark(SUN7I_MARK_SYSCORE);
+	/* moved on by every non-boot CPU that comes back */
+	sun7i_resume_mark(SUN7I_MARK_CPUS);
+}
+
+static struct syscore_ops sun7i_resume_syscore_ops = {
+	.suspend	= sun7i_resume_syscore_suspend,
+	.resume		= sun7i_resume_syscore_resume,
+};
+
+static int sun7i_resume_cpu_notify(struct notifier_block *nb,
+				   unsigned long action, void *hcpu)
+{
+	if (action == CPU_ONLINE_FROZEN)
+		sun7i_resume_mark(SUN7I_MARK_CPUS);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block sun7i_resume_cpu_nb = {
+	.notifier_call	= sun7i_resume_cpu_notify,
+};
+
+static int sun7i_resume_pm_notify(struct notifier_block *nb,
+				  unsigned long action, void *unused)
+{
+	if (action == PM_POST_SUSPEND) {
+		sun7i_resume_mark(SUN7I_MARK_POST);
+		sun7i_resume_account();
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block sun7i_resume_pm_nb = {
+	.notifier_call	= sun7i_resume_pm_notify,
+};
+
+/*
+ * The marker is registered at late_initcall and resumes after every
+ * synchronous device registered before it; devices hotplugged later,
+ * such as USB ones, are resumed asynchronously and end up in "finish".
+ */
+static int sun7i_resume_marker_noirq(struct device *dev)
+{
+	sun7i_resume_mark(SUN7I_MARK_NOIRQ);
+	return 0;
+}
+
+static int sun7i_resume_marker_resume(struct device *dev)
+{
+	sun7i_resume_mark(SUN7I_MARK_DEVICES);
+	return 0;
+}
+
+static struct dev_pm_domain sun7i_resume_marker_domain = {
+	.ops = {
+		.resume_noirq	= sun7i_resume_marker_noirq,
+		.resume		= sun7i_resume_marker_resume,
+	},
+};
+
+/*
+ * Per-device timing. A PM domain carrying a copy of the device's own
+ * callbacks is put in front of them, with the two resume callbacks
+ * wrapped, so the device sees no change in which callbacks run. It is
+ * only installed from BUS_NOTIFY_ADD_DEVICE, before any driver binds.
+ * BUS_NOTIFY_DEL_DEVICE comes while the device is still on the dpm
+ * list, so it only retires the domain. A work takes the domain down
+ * once the device has left the list, under the device lock so that no
+ * resume callback can still be running through it.
+ */
+struct sun7i_resume_dev {
+	struct list_head	list;
+	struct device		*dev;
+	const struct dev_pm_ops	*ops;
+	struct dev_pm_domain	domain;
+	u32			noirq_us;
+	u32			resume_us;
+	u32			max_us;
+};
+
+static LIST_HEAD(sun7i_resume_devs);
+static LIST_HEAD(sun7i_resume_devs_gone);	/* deleted, device pinned */
+static DEFINE_MUTEX(sun7i_resume_devs_lock);
+
+/* I2C clients resumed asynchronously: no dependency but their adapter */
+static const char * const sun7i_resume_async_i2c[] = {
+	"radio-rda5807",
+	"ds1307",
+};
+
+static inline struct sun7i_resume_dev *sun7i_resume_dev_of(struct device *dev)
+{
+	return container_of(dev->pm_domain, struct sun7i_resume_dev, domain);
+}
+
+static int sun7i_resume_dev_noirq(struct device *dev)
+{
+	struct sun7i_resume_dev *rd = sun7i_resume_dev_of(dev);
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = rd->ops->resume_noirq(dev);
+	rd->noirq_us = ktime_us_delta(ktime_get(), start);
+	return ret;
+}
+
+static int sun7i_resume_dev_resume(struct device *dev)
+{
+	struct sun7i_resume_dev *rd = sun7i_resume_dev_of(dev);
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = rd->ops->resume(dev);
+	rd->resume_us = ktime_us_delta(ktime_get(), start);
+	if (rd->noirq_us + rd->resume_us > rd->max_us)
+		rd->max_us = rd->noirq_us + rd->resume_us;
+	return ret;
+}
+
+/* the callbacks the PM core would pick for the device, in its order */
+static const struct dev_pm_ops *sun7i_resume_dev_ops(struct device *dev)
+{
+	if (dev->type && dev->type->pm)
+		return dev->type->pm;
+	if (dev->class && dev->class->pm)
+		return dev->class->pm;
+	if (dev->bus && dev->bus->pm)
+		return dev->bus->pm;
+	return NULL;
+}
+
+static void sun7i_resume_dev_attach(struct device *dev, bool async)
+{
+	const struct dev_pm_ops *ops = sun7i_resume_dev_ops(dev);
+	struct sun7i_resume_dev *rd;
+
+	if (async)
+		device_enable_async_suspend(dev);
+
+	if (dev->pm_domain || !ops || (!ops->resume_noirq && !ops->resume))
+		return;
+
+	rd = kzalloc(sizeof(*rd), GFP_KERNEL);
+	if (!rd) {
+		dev_warn(dev, "resume not timed\n");
+		return;
+	}
+	rd->dev = dev;
+	rd->ops = ops;
+	rd->domain.ops = *ops;
+	if (ops->resume_noirq)
+		rd->domain.ops.resume_noirq = sun7i_resume_dev_noirq;
+	if (ops->resume)
+		rd->domain.ops.resume = sun7i_resume_dev_resume;
+
+	mutex_lock(&sun7i_resume_devs_lock);
+	dev->pm_domain = &rd->domain;
+	list_add_tail(&rd->list, &sun7i_resume_devs);
+	mutex_unlock(&sun7i_resume_devs_lock);
+}
+
+static void sun7i_resume_dev_reap(struct work_struct *work);
+static DECLARE_DELAYED_WORK(sun7i_resume_reap_work, sun7i_resume_dev_reap);
+
+static void sun7i_resume_dev_reap(struct work_struct *work)
+{
+	struct sun7i_resume_dev *rd, *n;
+	LIST_HEAD(done);
+	bool again;
+
+	mutex_lock(&sun7i_resume_devs_lock);
+	list_for_each_entry_safe(rd, n, &sun7i_resume_devs_gone, list)
+		if (list_empty(&rd->dev->power.entry))
+			list_move_tail(&rd->list, &done);
+	again = !list_empty(&sun7i_resume_devs_gone);
+	mutex_unlock(&sun7i_resume_devs_lock);
+
+	list_for_each_entry_safe(rd, n, &done, list) {
+		device_lock(rd->dev);
+		spin_lock_irq(&rd->dev->power.lock);
+		if (rd->dev->pm_domain == &rd->domain)
+			rd->dev->pm_domain = NULL;
+		spin_unlock_irq(&rd->dev->power.lock);
+		device_unlock(rd->dev);
+
+		put_device(rd->dev);
+		kfree(rd);
+	}
+
+	/* device_del() has not reached device_pm_remove() yet */
+	if (again)
+		schedule_delayed_work(&sun7i_resume_reap_work, HZ);
+}
+
+static void sun7i_resume_dev_detach(struct device *dev)
+{
+	struct sun7i_resume_dev *rd;
+
+	mutex_lock(&sun7i_resume_devs_lock);
+	list_for_each_entry(rd, &sun7i_resume_devs, list) {
+		if (rd->dev != dev)
+			continue;
+		get_device(dev);
+		list_move_tail(&rd->list, &sun7i_resume_devs_gone);
+		schedule_delayed_work(&sun7i_resume_reap_work, 0);
+		break;
+	}
+	mutex_unlock(&sun7i_resume_devs_lock);
+}
+
+static bool sun7i_resume_i2c_async(struct i2c_client *client)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sun7i_resume_async_i2c); i++)
+		if (!strcmp(client->name, sun7i_resume_async_i2c[i]))
+			return true;
+	return false;
+}
+
+static int sun7i_resume_i2c_notify(struct notifier_block *nb,
+				   unsigned long action, void *data)
+{
+	struct device *dev = data;
+	struct i2c_client *client = i2c_verify_client(dev);
+
+	if (!client)
+		return NOTIFY_DONE;
+
+	switch (action) {
+	case BUS_NOTIFY_ADD_DEVICE:
+		sun7i_resume_dev_attach(dev, sun7i_resume_i2c_async(client));
+		break;
+	case BUS_NOTIFY_DEL_DEVICE:
+		sun7i_resume_dev_detach(dev);
+		break;
+	}
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block sun7i_resume_i2c_nb = {
+	.notifier_call	= sun7i_resume_i2c_notify,
+};
+
+#ifdef CONFIG_USB
+/*
+ * USB devices are async already; the Wi-Fi dongle is timed from here.
+ * The bus notifier runs before the device is probed, unlike
+ * USB_DEVICE_ADD, and also sees interfaces, which are left alone.
+ */
+static int sun7i_resume_usb_notify(struct notifier_block *nb,
+				   unsigned long action, void *data)
+{
+	struct device *dev = data;
+
+	if (!dev->type || strcmp(dev->type->name, "usb_device"))
+		return NOTIFY_DONE;
+
+	switch (action) {
+	case BUS_NOTIFY_ADD_DEVICE:
+		sun7i_resume_dev_attach(dev, false);
+		break;
+	case BUS_NOTIFY_DEL_DEVICE:
+		sun7i_resume_dev_detach(dev);
+		break;
+	}
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block sun7i_resume_usb_nb = {
+	.notifier_call	= sun7i_resume_usb_notify,
+};
+#endif
+
+#ifdef CONFIG_DEBUG_FS
+static int sun7i_resume_show(struct seq_file *m, void *unused)
+{
+	struct sun7i_resume_dev *rd;
+	u32 cycles = sun7i_resume.cycles;
+	int i;
+
+	seq_printf(m, "cycles: %u\n", cycles);
+	seq_printf(m, "asleep_ms: %u (firmware included)\n",
+		   sun7i_resume.sleep_ms);
+	seq_printf(m, "%-8s %10s %10s %10s\n",
+		   "phase", "last_us", "max_us", "avg_us");
+	for (i = 0; i < SUN7I_MARK_NUM; i++)
+		seq_printf(m, "%-8s %10u %10u %10llu\n", sun7i_resume_phase[i],
+			   sun7i_resume.last_us[i], sun7i_resume.max_us[i],
+			   cycles ? div_u64(sun7i_resume.total_us[i], cycles)
+				  : 0);
+
+	seq_printf(m, "\n%-24s %10s %10s %10s %s\n",
+		   "device", "noirq_us", "resume_us", "max_us", "async");
+	mutex_lock(&sun7i_resume_devs_lock);
+	list_for_each_entry(rd, &sun7i_resume_devs, list) {
+		seq_printf(m, "%-24s %10u %10u %10u %s\n", dev_name(rd->dev),
+			   rd->noirq_us, rd->resume_us, rd->max_us,
+			   rd->dev->power.async_suspend ? "y" : "n");
+	}
+	mutex_unlock(&sun7i_resume_devs_lock);
+	return 0;
+}
+
+static int sun7i_resume_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sun7i_resume_show, NULL);
+}
+
+static const struct file_operations sun7i_resume_fops = {
+	.owner		= THIS_MODULE,
+	.open		= sun7i_resume_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
+/* from init_machine, before any I2C adapter can create its clients */
+static void __init sun7i_resume_prof_bus_init(void)
+{
+	bus_register_notifier(&i2c_bus_type, &sun7i_resume_i2c_nb);
+}
+
+#ifdef CONFIG_USB
+/* after usb_init() registered the bus, before any HCD adds a device */
+static int __init sun7i_resume_prof_usb_init(void)
+{
+	return bus_register_notifier(&usb_bus_type, &sun7i_resume_usb_nb);
+}
+fs_initcall(sun7i_resume_prof_usb_init);
+#endif
+
+static int __init sun7i_resume_prof_init(void)
+{
+	struct platform_device *marker;
+
+	marker = platform_device_alloc("sun7i-resume-marker", -1);
+	if (marker) {
+		marker->dev.pm_domain = &sun7i_resume_marker_domain;
+		if (platform_device_add(marker)) {
+			platform_device_put(marker);
+			pr_warn("%s: no resume marker, phases not timed\n",
+				__func__);
+		}
+	}
+
+	register_syscore_ops(&sun7i_resume_syscore_ops);
+	register_cpu_notifier(&sun7i_resume_cpu_nb);
+	register_pm_notifier(&sun7i_resume_pm_nb);
+#ifdef CONFIG_DEBUG_FS
+	debugfs_create_file("sun7i_resume", S_IRUGO, NULL, NULL,
+			    &sun7i_resume_fops);
+#endif
+	return 0;
+}
+late_initcall(sun7i_resume_prof_init);
+
+#else
+
+static inline void sun7i_resume_prof_bus_init(void)
+{
+}
+
+#endif /* CONFIG_PM_SLEEP */
+
 
 static void sun7i_restart(char mode, const char *cmd)
 {
@@ -206,8 +792,10 @@ static void __init sun7i_init(void)
 {
 	pr_info("%s: enter\n", __func__);
 	
+	sun7i_resume_prof_bus_init();
+
 	sw_pdev_init();
-	
+
 	i2c_register_board_info(1, __rtc_i2c_board_info,
 							ARRAY_SIZE(__rtc_i2c_board_info));
 }
@@ -32,17 +32,33 @@
 
 
 #include <asm/byteorder.h>
+#include <linux/atomic.h>
 #include <linux/bitops.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
 #include <linux/module.h>
 #include <linux/i2c.h>
+#include <linux/interrupt.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
 #include <linux/pm.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/sysfs.h>
 #include <linux/types.h>
 #include <linux/videodev2.h>
+#include <linux/workqueue.h>
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-dev.h>
 #include <media/v4l2-ioctl.h>
+#ifdef CONFIG_RADIO_RDA5807_I2S
+#include <sound/pcm.h>
+#include <sound/pcm_params.h>
+#include <sound/soc.h>
+#endif
 
 
 enum rda5807_reg {
@@ -51,8 +67,13 @@ enum rda5807_reg {
 	RDA5807_REG_CHAN		= 0x03,
 	RDA5807_REG_IOCFG		= 0x04,
 	RDA5807_REG_INTM_THRESH_VOL	= 0x05,
+	RDA5807_REG_I2S			= 0x06,
 	RDA5807_REG_SEEK_RESULT		= 0x0A,
 	RDA5807_REG_SIGNAL		= 0x0B,
+	RDA5807_REG_RDSA		= 0x0C,
+	RDA5807_REG_RDSB		= 0x0D,
+	RDA5807_REG_RDSC		= 0x0E,
+	RDA5807_REG_RDSD		= 0x0F,
 };
 
 #define RDA5807_MASK_CTRL_DHIZ		BIT(15)
@@ -63,6 +84,7 @@ enum rda5807_reg {
 #define RDA5807_MASK_CTRL_SEEK		BIT(8)
 #define RDA5807_MASK_CTRL_SKMODE	BIT(7)
 #define RDA5807_MASK_CTRL_CLKMODE	(7 << 4)
+#define RDA5807_MASK_CTRL_RDS_EN	BIT(3)
 #define RDA5807_MASK_CTRL_SOFTRESET	BIT(1)
 #define RDA5807_MASK_CTRL_ENABLE	BIT(0)
 
@@ -74,21 +96,109 @@ enum rda5807_reg {
 #define RDA5807_SHIFT_CHAN_SPACE	0
 #define RDA5807_MASK_CHAN_SPACE		(0x3 << RDA5807_SHIFT_CHAN_SPACE)
 
+#define RDA5807_MASK_SEEKRES_RDSR	BIT(15)
 #define RDA5807_MASK_SEEKRES_COMPLETE	BIT(14)
 #define RDA5807_MASK_SEEKRES_FAIL	BIT(13)
+#define RDA5807_MASK_SEEKRES_RDSS	BIT(12)
 #define RDA5807_MASK_SEEKRES_STEREO	BIT(10)
 
+#define RDA5807_MASK_RDS_IEN		BIT(15)
+#define RDA5807_MASK_STC_IEN		BIT(14)
 #define RDA5807_MASK_DEEMPHASIS		BIT(11)
-
+#define RDA5807_MASK_I2S_ENABLE		BIT(6)
+#define RDA5807_SHIFT_GPIO2		2
+#define RDA5807_MASK_GPIO2		(0x3 << RDA5807_SHIFT_GPIO2)
+#define RDA5807_GPIO2_INT		1
+
+#define RDA5807_MASK_I2S_SLAVE		BIT(12)
+#define RDA5807_MASK_I2S_WS_LR		BIT(11)
+#define RDA5807_MASK_I2S_SCLK_I_EDGE	BIT(10)
+#define RDA5807_MASK_I2S_SIGNED		BIT(9)
+#define RDA5807_MASK_I2S_WS_I_EDGE	BIT(8)
+#define RDA5807_SHIFT_I2S_SW_CNT	4
+#define RDA5807_MASK_I2S_SW_CNT		(0xF << RDA5807_SHIFT_I2S_SW_CNT)
+#define RDA5807_MASK_I2S_WS_O_EDGE	BIT(3)
+#define RDA5807_MASK_I2S_SCLK_O_EDGE	BIT(2)
+#define RDA5807_MASK_I2S_L_DELY		BIT(1)
+#define RDA5807_MASK_I2S_R_DELY		BIT(0)
+#define RDA5807_MASK_I2S_FMT		(RDA5807_MASK_I2S_SLAVE \
+					| RDA5807_MASK_I2S_WS_LR \
+					| RDA5807_MASK_I2S_SCLK_I_EDGE \
+					| RDA5807_MASK_I2S_SIGNED \
+					| RDA5807_MASK_I2S_WS_I_EDGE \
+					| RDA5807_MASK_I2S_WS_O_EDGE \
+					| RDA5807_MASK_I2S_SCLK_O_EDGE \
+					| RDA5807_MASK_I2S_L_DELY \
+					| RDA5807_MASK_I2S_R_DELY)
+
+#define RDA5807_MASK_INT_MODE		BIT(15)	/* 0: 5 ms pulse */
 #define RDA5807_SHIFT_VOLUME_DAC	0
 #define RDA5807_MASK_VOLUME_DAC		(0xF << RDA5807_SHIFT_VOLUME_DAC)
 
 #define RDA5807_SHIFT_RSSI		9
 #define RDA5807_MASK_RSSI		(0x7F << RDA5807_SHIFT_RSSI)
+#define RDA5807_SHIFT_BLERA		2
+#define RDA5807_MASK_BLERA		(0x3 << RDA5807_SHIFT_BLERA)
+#define RDA5807_SHIFT_BLERB		0
+#define RDA5807_MASK_BLERB		(0x3 << RDA5807_SHIFT_BLERB)
+#define RDA5807_BLER_UNCORRECTABLE	3
 
 #define RDA5807_FREQ_MIN_KHZ  76000
 #define RDA5807_FREQ_MAX_KHZ 108000
 
+/*
+ * I2C calls of this client. The RDA5807 shares its bus with other
+ * devices (the RTC on sun7i I2C-1). Each i2c_transfer() call is timed
+ * as a whole, waiting for the adapter lock included, so the times are
+ * not bus occupancy. A rising average against a steady minimum shows
+ * contention with the other users.
+ */
+struct rda5807_i2c_stats {
+	spinlock_t	lock;
+	ktime_t		since;
+	u32		transfers;
+	u32		errors;
+	u64		bytes;
+	u64		call_us;
+	u32		min_call_us;
+	u32		max_call_us;
+};
+
+static struct rda5807_i2c_stats *
+rda5807_client_stats(struct i2c_client *client);
+
+static int rda5807_i2c_xfer(struct i2c_client *client, struct i2c_msg *msgs,
+			    int num)
+{
+	struct rda5807_i2c_stats *stats;
+	ktime_t start;
+	u32 call_us;
+	int ret, i;
+
+	start = ktime_get();
+	ret = i2c_transfer(client->adapter, msgs, num);
+	call_us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	stats = rda5807_client_stats(client);
+	if (!stats)
+		return ret;
+
+	spin_lock(&stats->lock);
+	stats->transfers++;
+	if (ret < 0)
+		stats->errors++;
+	for (i = 0; i < num; i++)
+		stats->bytes += msgs[i].len;
+	stats->call_us += call_us;
+	if (!stats->min_call_us || call_us < stats->min_call_us)
+		stats->min_call_us = call_us;
+	if (call_us > stats->max_call_us)
+		stats->max_call_us = call_us;
+	spin_unlock(&stats->lock);
+
+	return ret;
+}
+
 static int rda5807_i2c_read(struct i2c_client *client, enum rda5807_reg reg)
 {
 	__u8  reg_buf = reg;
@@ -109,11 +219,11 @@ static int rda5807_i2c_read(struct i2c_client *client, enum rda5807_reg reg)
 	};
 	int err;
 
-	err = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	err = rda5807_i2c_xfer(client, msgs, ARRAY_SIZE(msgs));
 	if (err < 0) return err;
 	if (err < ARRAY_SIZE(msgs)) return -EIO;
 
-	dev_info(&client->dev, "reg[%02X] = %04X\n", reg, be16_to_cpu(val_buf));
+	dev_dbg(&client->dev, "reg[%02X] = %04X\n", reg, be16_to_cpu(val_buf));
 	return be16_to_cpu(val_buf);
 }
 
@@ -131,20 +241,103 @@ static int rda5807_i2c_write(struct i2c_client *client, enum rda5807_reg reg,
 	};
 	int err;
 
-	err = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+	err = rda5807_i2c_xfer(client, msgs, ARRAY_SIZE(msgs));
 	if (err < 0) return err;
 	if (err < ARRAY_SIZE(msgs)) return -EIO;
 
-	dev_info(&client->dev, "reg[%02X] := %04X\n", reg, val);
+	dev_dbg(&client->dev, "reg[%02X] := %04X\n", reg, val);
 	return 0;
 }
 
+#define RDA5807_RDS_POLL_MS		40
+#define RDA5807_RDS_AF_MAX		25
+
+struct rda5807_rds {
+	/* station data, every change bumps version */
+	u32	version;
+	u16	pi;
+	u8	pty;
+	u8	tp;
+	char	ps[9];
+	char	rt[65];
+	u32	af_khz[RDA5807_RDS_AF_MAX];
+	u8	af_count;
+	bool	af_lfmf;		/* code 250 seen, next code is LF/MF */
+	bool	ct_valid;
+	u16	ct_year;
+	u8	ct_month;
+	u8	ct_day;
+	u8	ct_hour;		/* UTC */
+	u8	ct_minute;
+	s8	ct_offset;		/* local time offset, half hours */
+
+	/* group assembly */
+	u16	last_blk[4];
+	char	ps_buf[8];
+	u8	ps_seen;		/* segments received, bit per segment */
+	char	rt_buf[64];
+	u16	rt_seen;
+	u8	rt_ab;
+
+	u32	groups;
+	u32	errors;
+};
+
+#define RDA5807_TUNE_TIMEOUT_MS		100
+#define RDA5807_AF_CHECK_MS		500
+#define RDA5807_AF_HOLDOFF_MS		5000	/* after an attempt that kept us */
+#define RDA5807_AF_PI_TIMEOUT_MS	400
+#define RDA5807_AF_RSSI_MARGIN		6
+#define RDA5807_AF_PROBES_MAX		3	/* AFs tuned per check */
+#define RDA5807_AF_THRESHOLD_DEFAULT	25
+
+struct rda5807_af {
+	bool		enabled;
+	u8		threshold;	/* RSSI below which alternatives are tried */
+	unsigned long	next_check;	/* jiffies */
+	u8		next_af;	/* first AF to probe on the next check */
+
+	u32		attempts;
+	u32		switches;
+	u32		pi_mismatch;
+	u32		no_better;
+	u32		last_gap_us;	/* audio muted while trying */
+	u32		max_gap_us;
+	u32		last_latency_us; /* RSSI drop seen to decision */
+	u32		max_latency_us;
+};
+
 struct rda5807_driver {
 	struct v4l2_ctrl_handler	ctrl_handler;
 	struct video_device		video_dev;
 	struct i2c_client		*i2c_client;
+	struct mutex			lock;	/* read-modify-write of registers */
+	struct mutex			tune_lock;
+	u32				freq_khz;
+	struct delayed_work		rds_work;
+	struct mutex			rds_lock;
+	struct rda5807_rds		rds;
+	struct rda5807_af		af;
+	struct rda5807_i2c_stats	i2c_stats;
+	struct dentry			*debugfs;
+	int				irq;	/* 0: completion is polled */
+	struct completion		stc_done;
+	atomic_t			stc_armed; /* tune written, STC is ours */
+	struct completion		rds_done;
+	u32				irq_count;
+	u32				irq_stc;
+	u32				irq_rds;
 };
 
+/* NULL until probe has set up the driver data */
+static struct rda5807_i2c_stats *
+rda5807_client_stats(struct i2c_client *client)
+{
+	struct rda5807_driver *radio = i2c_get_clientdata(client);
+
+	return radio ? &radio->i2c_stats : NULL;
+}
+
 static const struct v4l2_file_operations rda5807_fops = {
 	.owner		= THIS_MODULE,
 	.unlocked_ioctl	= video_ioctl2,
@@ -154,23 +347,635 @@ static int rda5807_update_reg(struct rda5807_driver *radio,
 			      enum rda5807_reg reg, u16 mask, u16 val)
 {
 	int err = 0;
-	// TODO: Locking.
-	//       Or do locking in the caller, in case we ever need to update
-	//       two registers in one operation?
+
+	/* V4L2 and ASoC callers may update the same register concurrently. */
+	mutex_lock(&radio->lock);
 	err = rda5807_i2c_read(radio->i2c_client, reg);
 	if (err >= 0) {
 		val |= ((u16)err & ~mask);
 		err = rda5807_i2c_write(radio->i2c_client, reg, val);
 	}
+	mutex_unlock(&radio->lock);
+	return err;
+}
+
+static int rda5807_tune(struct rda5807_driver *radio, u32 freq_khz)
+{
+	u16 mask = 0;
+	u16 val = 0;
+	int err;
+
+	/* select widest band */
+	mask |= RDA5807_MASK_CHAN_BAND;
+	val  |= 2 << RDA5807_SHIFT_CHAN_BAND;
+	/* select 50 kHz channel spacing */
+	mask |= RDA5807_MASK_CHAN_SPACE;
+	val  |= 2 << RDA5807_SHIFT_CHAN_SPACE;
+	/* select frequency */
+	mask |= RDA5807_MASK_CHAN_WRCHAN;
+	val  |= ((freq_khz - RDA5807_FREQ_MIN_KHZ + 25) / 50)
+			<< RDA5807_SHIFT_CHAN_WRCHAN;
+	/* start tune operation */
+	mask |= RDA5807_MASK_CHAN_TUNE;
+	val  |= RDA5807_MASK_CHAN_TUNE;
+
+	/*
+	 * STC stays set from the previous tune until the chip starts this
+	 * one, so an RDS interrupt before the write would see it. It only
+	 * counts once the write is done; see rda5807_irq_thread().
+	 */
+	atomic_set(&radio->stc_armed, 0);
+	INIT_COMPLETION(radio->stc_done);
+	INIT_COMPLETION(radio->rds_done);
+
+	err = rda5807_update_reg(radio, RDA5807_REG_CHAN, mask, val);
+	if (err >= 0)
+		atomic_set(&radio->stc_armed, 1);
 	return err;
 }
 
+static int rda5807_wait_tune(struct rda5807_driver *radio)
+{
+	int i, err;
+
+	if (radio->irq) {
+		if (wait_for_completion_timeout(&radio->stc_done,
+				msecs_to_jiffies(RDA5807_TUNE_TIMEOUT_MS)))
+			return 0;
+		/* the pulse came before the tune was armed */
+		err = rda5807_i2c_read(radio->i2c_client,
+				       RDA5807_REG_SEEK_RESULT);
+		if (err < 0)
+			return err;
+		return (err & RDA5807_MASK_SEEKRES_COMPLETE) ? 0 : -ETIMEDOUT;
+	}
+
+	for (i = 0; i < RDA5807_TUNE_TIMEOUT_MS / 5; i++) {
+		usleep_range(5000, 6000);
+		err = rda5807_i2c_read(radio->i2c_client,
+				       RDA5807_REG_SEEK_RESULT);
+		if (err < 0)
+			return err;
+		if (err & RDA5807_MASK_SEEKRES_COMPLETE)
+			return 0;
+	}
+	return -ETIMEDOUT;
+}
+
+static int rda5807_read_rssi(struct rda5807_driver *radio)
+{
+	int err = rda5807_i2c_read(radio->i2c_client, RDA5807_REG_SIGNAL);
+
+	if (err < 0)
+		return err;
+	return ((u16)err & RDA5807_MASK_RSSI) >> RDA5807_SHIFT_RSSI;
+}
+
+/*
+ * RDS.
+ * While the receiver is enabled decoded groups are fetched, by a delayed
+ * work polling for them or from the interrupt thread, and 0A/0B/2A/2B/4A
+ * are parsed once in the driver, so consumers read finished station data
+ * from sysfs instead of decoding groups themselves. Every change bumps
+ * rds.version and wakes up pollers of the rds_version attribute.
+ */
+
+static void rda5807_rds_add_af(struct rda5807_rds *rds, u8 code,
+			       bool *changed)
+{
+	u32 khz;
+	int i;
+
+	/* 250: the next code is an LF/MF frequency, not a VHF one */
+	if (rds->af_lfmf) {
+		rds->af_lfmf = false;
+		return;
+	}
+	if (code == 250) {
+		rds->af_lfmf = true;
+		return;
+	}
+
+	/* 1..204: 87.6 .. 107.9 MHz; list lengths and fillers are skipped */
+	if (code < 1 || code > 204)
+		return;
+	khz = 87500 + code * 100;
+
+	for (i = 0; i < rds->af_count; i++)
+		if (rds->af_khz[i] == khz)
+			return;
+	if (rds->af_count >= RDA5807_RDS_AF_MAX)
+		return;
+
+	rds->af_khz[rds->af_count++] = khz;
+	*changed = true;
+}
+
+static void rda5807_rds_parse_ct(struct rda5807_rds *rds, const u16 *blk,
+				 bool *changed)
+{
+	u32 mjd, yd, y, m, d, k;
+	u8 hour, minute;
+	s8 offset;
+
+	mjd = ((blk[1] & 0x3) << 15) | (blk[2] >> 1);
+	hour = ((blk[2] & 0x1) << 4) | (blk[3] >> 12);
+	minute = (blk[3] >> 6) & 0x3F;
+	offset = blk[3] & 0x1F;
+	if (blk[3] & BIT(5))
+		offset = -offset;
+
+	if (mjd < 15079 || hour > 23 || minute > 59)
+		return;
+
+	/* MJD to date, RDS standard annex G in fixed point */
+	y = (mjd * 100 - 1507820) / 36525;
+	yd = (y * 36525) / 100;
+	m = ((mjd - 14956 - yd) * 10000 - 1000) / 306001;
+	d = mjd - 14956 - yd - (m * 306001) / 10000;
+	k = (m == 14 || m == 15) ? 1 : 0;
+	y += k;
+	m = m - 1 - k * 12;
+
+	if (rds->ct_valid && rds->ct_year == 1900 + y && rds->ct_month == m
+	    && rds->ct_day == d && rds->ct_hour == hour
+	    && rds->ct_minute == minute && rds->ct_offset == offset)
+		return;
+
+	rds->ct_valid = true;
+	rds->ct_year = 1900 + y;
+	rds->ct_month = m;
+	rds->ct_day = d;
+	rds->ct_hour = hour;
+	rds->ct_minute = minute;
+	rds->ct_offset = offset;
+	*changed = true;
+}
+
+static void rda5807_rds_parse_rt(struct rda5807_rds *rds, const u16 *blk,
+				 bool version_b, bool *changed)
+{
+	u8 ab = (blk[1] >> 4) & 0x1;
+	u8 seg = blk[1] & 0xF;
+	int chars = version_b ? 2 : 4;
+	int len = chars * 16;
+	int end, nseg;
+	u16 needed;
+	char *p;
+
+	/* A/B flag toggled: the station starts a new text */
+	if (ab != rds->rt_ab || !rds->rt_seen) {
+		memset(rds->rt_buf, ' ', sizeof(rds->rt_buf));
+		rds->rt_seen = 0;
+		rds->rt_ab = ab;
+	}
+
+	p = &rds->rt_buf[seg * chars];
+	if (version_b) {
+		p[0] = blk[3] >> 8;
+		p[1] = blk[3] & 0xFF;
+	} else {
+		p[0] = blk[2] >> 8;
+		p[1] = blk[2] & 0xFF;
+		p[2] = blk[3] >> 8;
+		p[3] = blk[3] & 0xFF;
+	}
+	rds->rt_seen |= BIT(seg);
+
+	/* complete up to the carriage return, or all segments without one */
+	for (end = 0; end < len; end++)
+		if (rds->rt_buf[end] == 0x0D)
+			break;
+	nseg = (end < len) ? end / chars + 1 : 16;
+	needed = (nseg >= 16) ? 0xFFFF : BIT(nseg) - 1;
+	if ((rds->rt_seen & needed) != needed)
+		return;
+
+	while (end > 0 && rds->rt_buf[end - 1] == ' ')
+		end--;
+	if (strlen(rds->rt) == end && !memcmp(rds->rt, rds->rt_buf, end))
+		return;
+
+	memcpy(rds->rt, rds->rt_buf, end);
+	rds->rt[end] = '\0';
+	*changed = true;
+}
+
+/* Returns true when the published station data changed. */
+static bool rda5807_rds_parse(struct rda5807_rds *rds, const u16 *blk)
+{
+	u8 group = blk[1] >> 12;
+	bool version_b = blk[1] & BIT(11);
+	bool changed = false;
+	u8 seg;
+
+	if (blk[0] != rds->pi) {
+		/* another station, drop everything learnt from the old one */
+		memset(rds->ps, 0, sizeof(rds->ps));
+		memset(rds->rt, 0, sizeof(rds->rt));
+		rds->af_count = 0;
+		rds->af_lfmf = false;
+		rds->ct_valid = false;
+		rds->ps_seen = 0;
+		rds->rt_seen = 0;
+		rds->pi = blk[0];
+		changed = true;
+	}
+
+	if (rds->pty != ((blk[1] >> 5) & 0x1F)
+	    || rds->tp != ((blk[1] >> 10) & 0x1)) {
+		rds->pty = (blk[1] >> 5) & 0x1F;
+		rds->tp = (blk[1] >> 10) & 0x1;
+		changed = true;
+	}
+
+	switch (group) {
+	case 0:
+		seg = blk[1] & 0x3;
+		rds->ps_buf[seg * 2] = blk[3] >> 8;
+		rds->ps_buf[seg * 2 + 1] = blk[3] & 0xFF;
+		rds->ps_seen |= BIT(seg);
+		if (rds->ps_seen == 0xF) {
+			if (memcmp(rds->ps, rds->ps_buf, 8)) {
+				memcpy(rds->ps, rds->ps_buf, 8);
+				changed = true;
+			}
+			rds->ps_seen = 0;
+		}
+		if (!version_b) {
+			rda5807_rds_add_af(rds, blk[2] >> 8, &changed);
+			rda5807_rds_add_af(rds, blk[2] & 0xFF, &changed);
+		}
+		break;
+	case 2:
+		rda5807_rds_parse_rt(rds, blk, version_b, &changed);
+		break;
+	case 4:
+		if (!version_b)
+			rda5807_rds_parse_ct(rds, blk, &changed);
+		break;
+	default:
+		break;
+	}
+
+	return changed;
+}
+
+/*
+ * Alternative frequencies.
+ * When enabled and the RSSI of the current frequency drops below the
+ * threshold, the audio is muted, up to RDA5807_AF_PROBES_MAX AFs of the
+ * station are tuned and measured, and the strongest one that beats the
+ * current RSSI by a margin is kept if it carries the same PI. Otherwise
+ * the original frequency is restored, and the next check goes on with
+ * the following AFs of the list. This bounds the mute of one check.
+ * The time the audio was muted and the time from seeing the drop to the
+ * decision are recorded.
+ */
+
+static int rda5807_wait_pi(struct rda5807_driver *radio)
+{
+	struct i2c_client *client = radio->i2c_client;
+	int status, signal, i;
+
+	for (i = 0; i < RDA5807_AF_PI_TIMEOUT_MS / 20; i++) {
+		if (radio->irq) {
+			if (!wait_for_completion_timeout(&radio->rds_done,
+						msecs_to_jiffies(20)))
+				continue;
+		} else {
+			msleep(20);
+			status = rda5807_i2c_read(client,
+						  RDA5807_REG_SEEK_RESULT);
+			if (status < 0)
+				return status;
+			if ((status & (RDA5807_MASK_SEEKRES_RDSR
+				       | RDA5807_MASK_SEEKRES_RDSS))
+				!= (RDA5807_MASK_SEEKRES_RDSR
+				    | RDA5807_MASK_SEEKRES_RDSS))
+				continue;
+		}
+		signal = rda5807_i2c_read(client, RDA5807_REG_SIGNAL);
+		if (signal < 0)
+			return signal;
+		if (((signal & RDA5807_MASK_BLERA) >> RDA5807_SHIFT_BLERA)
+				== RDA5807_BLER_UNCORRECTABLE)
+			continue;
+		return rda5807_i2c_read(client, RDA5807_REG_RDSA);
+	}
+	return -ETIMEDOUT;
+}
+
+static void rda5807_af_check(struct rda5807_driver *radio)
+{
+	struct rda5807_af *af = &radio->af;
+	u32 af_khz[RDA5807_RDS_AF_MAX];
+	u32 orig_khz, best_khz = 0;
+	ktime_t seen, muted;
+	u32 gap_us, latency_us;
+	int af_count, rssi, best_rssi, pi, i, n, probes;
+	bool switched = false;
+	u16 station_pi;
+	u32 seen_khz;
+
+	if (!af->enabled || time_before(jiffies, af->next_check))
+		return;
+	af->next_check = jiffies + msecs_to_jiffies(RDA5807_AF_CHECK_MS);
+
+	seen_khz = ACCESS_ONCE(radio->freq_khz);
+	mutex_lock(&radio->rds_lock);
+	station_pi = radio->rds.pi;
+	af_count = radio->rds.af_count;
+	memcpy(af_khz, radio->rds.af_khz, sizeof(af_khz));
+	mutex_unlock(&radio->rds_lock);
+	if (!station_pi || !af_count)
+		return;
+
+	rssi = rda5807_read_rssi(radio);
+	if (rssi < 0 || rssi >= af->threshold)
+		return;
+	seen = ktime_get();
+
+	mutex_lock(&radio->tune_lock);
+	orig_khz = radio->freq_khz;
+
+	/* retuned meanwhile, the list and the RSSI belong to the old station */
+	mutex_lock(&radio->rds_lock);
+	if (orig_khz != seen_khz || radio->rds.pi != station_pi) {
+		mutex_unlock(&radio->rds_lock);
+		mutex_unlock(&radio->tune_lock);
+		return;
+	}
+	mutex_unlock(&radio->rds_lock);
+	af->attempts++;
+
+	rda5807_update_reg(radio, RDA5807_REG_CTRL, RDA5807_MASK_CTRL_DMUTE, 0);
+	muted = ktime_get();
+
+	best_rssi = rssi + RDA5807_AF_RSSI_MARGIN;
+	if (af->next_af >= af_count)
+		af->next_af = 0;
+	for (n = 0, probes = 0; n < af_count && probes < RDA5807_AF_PROBES_MAX;
+	     n++) {
+		i = (af->next_af + n) % af_count;
+		if (af_khz[i] == orig_khz)
+			continue;
+		probes++;
+		if (rda5807_tune(radio, af_khz[i]) < 0
+		    || rda5807_wait_tune(radio) < 0)
+			continue;
+		rssi = rda5807_read_rssi(radio);
+		if (rssi > best_rssi) {
+			best_rssi = rssi;
+			best_khz = af_khz[i];
+		}
+	}
+	af->next_af = (af->next_af + n) % af_count;
+
+	if (!best_khz) {
+		af->no_better++;
+	} else if (rda5807_tune(radio, best_khz) >= 0
+		   && rda5807_wait_tune(radio) >= 0) {
+		pi = rda5807_wait_pi(radio);
+		if (pi == station_pi)
+			switched = true;
+		else
+			af->pi_mismatch++;
+	}
+
+	latency_us = ktime_to_us(ktime_sub(ktime_get(), seen));
+
+	if (switched) {
+		radio->freq_khz = best_khz;
+		af->switches++;
+	} else {
+		rda5807_tune(radio, orig_khz);
+		rda5807_wait_tune(radio);
+		af->next_check = jiffies + msecs_to_jiffies(RDA5807_AF_HOLDOFF_MS);
+	}
+
+	rda5807_update_reg(radio, RDA5807_REG_CTRL, RDA5807_MASK_CTRL_DMUTE,
+			   RDA5807_MASK_CTRL_DMUTE);
+	gap_us = ktime_to_us(ktime_sub(ktime_get(), muted));
+	mutex_unlock(&radio->tune_lock);
+
+	af->last_gap_us = gap_us;
+	if (gap_us > af->max_gap_us)
+		af->max_gap_us = gap_us;
+	af->last_latency_us = latency_us;
+	if (latency_us > af->max_latency_us)
+		af->max_latency_us = latency_us;
+
+	dev_dbg(&radio->i2c_client->dev, "AF %s: %u -> %u kHz, "
+		 "decision %u us, gap %u us\n",
+		 switched ? "switch" : "kept", orig_khz,
+		 switched ? best_khz : orig_khz, latency_us, gap_us);
+}
+
+static void rda5807_rds_notify(struct rda5807_driver *radio)
+{
+	sysfs_notify(&radio->i2c_client->dev.kobj, NULL, "rds_version");
+}
+
+/* Fetches and parses the group the chip flagged in the given status. */
+static void rda5807_rds_read(struct rda5807_driver *radio, int status)
+{
+	struct i2c_client *client = radio->i2c_client;
+	struct rda5807_rds *rds = &radio->rds;
+	u16 blk[4];
+	bool changed = false;
+	int signal, err, i;
+
+	if ((status & (RDA5807_MASK_SEEKRES_RDSR | RDA5807_MASK_SEEKRES_RDSS))
+		!= (RDA5807_MASK_SEEKRES_RDSR | RDA5807_MASK_SEEKRES_RDSS))
+		return;
+
+	signal = rda5807_i2c_read(client, RDA5807_REG_SIGNAL);
+	if (signal < 0)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(blk); i++) {
+		err = rda5807_i2c_read(client, RDA5807_REG_RDSA + i);
+		if (err < 0)
+			return;
+		blk[i] = err;
+	}
+
+	mutex_lock(&radio->rds_lock);
+	/* the ready flag may still be set for a group we already have */
+	if (!memcmp(blk, rds->last_blk, sizeof(blk))) {
+		mutex_unlock(&radio->rds_lock);
+		return;
+	}
+	memcpy(rds->last_blk, blk, sizeof(blk));
+
+	rds->groups++;
+	if (((signal & RDA5807_MASK_BLERA) >> RDA5807_SHIFT_BLERA)
+			== RDA5807_BLER_UNCORRECTABLE
+	    || ((signal & RDA5807_MASK_BLERB) >> RDA5807_SHIFT_BLERB)
+			== RDA5807_BLER_UNCORRECTABLE)
+		rds->errors++;
+	else
+		changed = rda5807_rds_parse(rds, blk);
+	if (changed)
+		rds->version++;
+	mutex_unlock(&radio->rds_lock);
+
+	if (changed)
+		rda5807_rds_notify(radio);
+}
+
+/*
+ * With an interrupt, groups are read by the IRQ thread and this work only
+ * runs the AF check, which needs no faster pace than RDA5807_AF_CHECK_MS.
+ */
+static void rda5807_rds_work(struct work_struct *work)
+{
+	struct rda5807_driver *radio = container_of(to_delayed_work(work),
+					struct rda5807_driver, rds_work);
+	int status;
+
+	rda5807_af_check(radio);
+
+	if (!radio->irq) {
+		status = rda5807_i2c_read(radio->i2c_client,
+					  RDA5807_REG_SEEK_RESULT);
+		if (status >= 0)
+			rda5807_rds_read(radio, status);
+	}
+
+	schedule_delayed_work(&radio->rds_work,
+			      msecs_to_jiffies(radio->irq ? RDA5807_AF_CHECK_MS
+							  : RDA5807_RDS_POLL_MS));
+}
+
+/*
+ * Interrupt.
+ * If the board info gives the client an IRQ, GPIO2 is switched to its
+ * interrupt function and pulses low on seek/tune complete and on RDS
+ * ready. The status register is read once per pulse to tell the two
+ * apart; waiters are woken through completions instead of polling it.
+ * Without an IRQ, or if it cannot be set up, polling is used.
+ */
+
+static irqreturn_t rda5807_irq_thread(int irq, void *dev_id)
+{
+	struct rda5807_driver *radio = dev_id;
+	int status, armed;
+
+	radio->irq_count++;
+	/* sampled first: armed means the status below follows the write */
+	armed = atomic_read(&radio->stc_armed);
+	status = rda5807_i2c_read(radio->i2c_client, RDA5807_REG_SEEK_RESULT);
+	if (status < 0)
+		return IRQ_HANDLED;
+
+	if ((status & RDA5807_MASK_SEEKRES_COMPLETE) && armed
+	    && atomic_cmpxchg(&radio->stc_armed, 1, 0) == 1) {
+		radio->irq_stc++;
+		complete(&radio->stc_done);
+	}
+	if ((status & (RDA5807_MASK_SEEKRES_RDSR | RDA5807_MASK_SEEKRES_RDSS))
+		== (RDA5807_MASK_SEEKRES_RDSR | RDA5807_MASK_SEEKRES_RDSS)) {
+		radio->irq_rds++;
+		complete(&radio->rds_done);
+		/* while an AF is probed the group belongs to another station */
+		if (mutex_trylock(&radio->tune_lock)) {
+			rda5807_rds_read(radio, status);
+			mutex_unlock(&radio->tune_lock);
+		}
+	}
+	return IRQ_HANDLED;
+}
+
+static void rda5807_irq_init(struct rda5807_driver *radio)
+{
+	struct i2c_client *client = radio->i2c_client;
+	int err;
+
+	if (client->irq <= 0)
+		return;
+
+	err = request_threaded_irq(client->irq, NULL, rda5807_irq_thread,
+				   IRQF_TRIGGER_FALLING | IRQF_ONESHOT,
+				   "radio-rda5807", radio);
+	if (err < 0) {
+		dev_warn(&client->dev, "Failed to request IRQ %d (%d), "
+			 "polling\n", client->irq, err);
+		return;
+	}
+
+	err = rda5807_update_reg(radio, RDA5807_REG_INTM_THRESH_VOL,
+				 RDA5807_MASK_INT_MODE, 0);
+	if (err >= 0)
+		err = rda5807_update_reg(radio, RDA5807_REG_IOCFG,
+					 RDA5807_MASK_RDS_IEN
+					 | RDA5807_MASK_STC_IEN
+					 | RDA5807_MASK_GPIO2,
+					 RDA5807_MASK_RDS_IEN
+					 | RDA5807_MASK_STC_IEN
+					 | (RDA5807_GPIO2_INT
+					    << RDA5807_SHIFT_GPIO2));
+	if (err < 0) {
+		dev_warn(&client->dev, "Failed to enable interrupt (%d), "
+			 "polling\n", err);
+		free_irq(client->irq, radio);
+		return;
+	}
+
+	radio->irq = client->irq;
+	dev_info(&client->dev, "Using IRQ %d\n", radio->irq);
+}
+
+static void rda5807_irq_exit(struct rda5807_driver *radio)
+{
+	if (!radio->irq)
+		return;
+
+	rda5807_update_reg(radio, RDA5807_REG_IOCFG,
+			   RDA5807_MASK_RDS_IEN | RDA5807_MASK_STC_IEN
+			   | RDA5807_MASK_GPIO2, 0);
+	free_irq(radio->irq, radio);
+	radio->irq = 0;
+}
+
+static void rda5807_rds_reset(struct rda5807_driver *radio)
+{
+	struct rda5807_rds *rds = &radio->rds;
+	u32 version, groups, errors;
+
+	mutex_lock(&radio->rds_lock);
+	version = rds->version;
+	groups = rds->groups;
+	errors = rds->errors;
+	memset(rds, 0, sizeof(*rds));
+	rds->version = version + 1;
+	rds->groups = groups;
+	rds->errors = errors;
+	mutex_unlock(&radio->rds_lock);
+
+	rda5807_rds_notify(radio);
+}
+
 static int rda5807_set_enable(struct rda5807_driver *radio, int enabled)
 {
-	u16 val = enabled ? RDA5807_MASK_CTRL_ENABLE : 0;
+	u16 val = enabled ? RDA5807_MASK_CTRL_ENABLE | RDA5807_MASK_CTRL_RDS_EN
+			  : 0;
+	int err;
+
 	dev_info(&radio->i2c_client->dev, "set enabled to %d\n", enabled);
-	return rda5807_update_reg(radio, RDA5807_REG_CTRL,
-				  RDA5807_MASK_CTRL_ENABLE, val);
+	err = rda5807_update_reg(radio, RDA5807_REG_CTRL,
+				 RDA5807_MASK_CTRL_ENABLE
+				 | RDA5807_MASK_CTRL_RDS_EN, val);
+	if (err < 0)
+		return err;
+
+	if (enabled)
+		schedule_delayed_work(&radio->rds_work,
+				      msecs_to_jiffies(RDA5807_RDS_POLL_MS));
+	else
+		cancel_delayed_work_sync(&radio->rds_work);
+	return 0;
 }
 
 static int rda5807_set_mute(struct rda5807_driver *radio, int muted)
@@ -201,8 +1006,7 @@ static int rda5807_set_preemphasis(struct rda5807_driver *radio,
 
 static int rda5807_set_frequency(struct rda5807_driver *radio, u32 freq_khz)
 {
-	u16 mask = 0;
-	u16 val = 0;
+	int err;
 
 	dev_info(&radio->i2c_client->dev, "set freq to %u kHz\n", freq_khz);
 
@@ -211,21 +1015,16 @@ static int rda5807_set_frequency(struct rda5807_driver *radio, u32 freq_khz)
 	if (freq_khz > RDA5807_FREQ_MAX_KHZ)
 		return -ERANGE;
 
-	/* select widest band */
-	mask |= RDA5807_MASK_CHAN_BAND;
-	val  |= 2 << RDA5807_SHIFT_CHAN_BAND;
-	/* select 50 kHz channel spacing */
-	mask |= RDA5807_MASK_CHAN_SPACE;
-	val  |= 2 << RDA5807_SHIFT_CHAN_SPACE;
-	/* select frequency */
-	mask |= RDA5807_MASK_CHAN_WRCHAN;
-	val  |= ((freq_khz - RDA5807_FREQ_MIN_KHZ + 25) / 50)
-			<< RDA5807_SHIFT_CHAN_WRCHAN;
-	/* start tune operation */
-	mask |= RDA5807_MASK_CHAN_TUNE;
-	val  |= RDA5807_MASK_CHAN_TUNE;
+	/* the station data goes with the frequency, see rda5807_af_check() */
+	mutex_lock(&radio->tune_lock);
+	err = rda5807_tune(radio, freq_khz);
+	if (err >= 0) {
+		radio->freq_khz = freq_khz;
+		rda5807_rds_reset(radio);
+	}
+	mutex_unlock(&radio->tune_lock);
 
-	return rda5807_update_reg(radio, RDA5807_REG_CHAN, mask, val);
+	return err < 0 ? err : 0;
 }
 
 static inline struct rda5807_driver *ctrl_to_radio(struct v4l2_ctrl *ctrl)
@@ -335,12 +1134,461 @@ static int rda5807_vidioc_s_frequency(struct file *file, void *fh,
 	return rda5807_set_frequency(radio, (a->frequency * 625) / 10000);
 }
 
+static inline struct rda5807_driver *dev_to_radio(struct device *dev)
+{
+	return i2c_get_clientdata(to_i2c_client(dev));
+}
+
+static ssize_t rda5807_rds_version_show(struct device *dev,
+					struct device_attribute *attr,
+					char *buf)
+{
+	struct rda5807_driver *radio = dev_to_radio(dev);
+	ssize_t len;
+
+	mutex_lock(&radio->rds_lock);
+	len = sprintf(buf, "%u\n", radio->rds.version);
+	mutex_unlock(&radio->rds_lock);
+	return len;
+}
+
+static ssize_t rda5807_rds_pi_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct rda5807_driver *radio = dev_to_radio(dev);
+	ssize_t len;
+
+	mutex_lock(&radio->rds_lock);
+	len = sprintf(buf, "%04X\n", radio->rds.pi);
+	mutex_unlock(&radio->rds_lock);
+	return len;
+}
+
+static ssize_t rda5807_rds_pty_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct rda5807_driver *radio = dev_to_radio(dev);
+	ssize_t len;
+
+	mutex_lock(&radio->rds_lock);
+	len = sprintf(buf, "%u %u\n", radio->rds.pty, radio->rds.tp);
+	mutex_unlock(&radio->rds_lock);
+	return len;
+}
+
+static ssize_t rda5807_rds_ps_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct rda5807_driver *radio = dev_to_radio(dev);
+	ssize_t len;
+
+	mutex_lock(&radio->rds_lock);
+	len = sprintf(buf, "%s\n", radio->rds.ps);
+	mutex_unlock(&radio->rds_lock);
+	return len;
+}
+
+static ssize_t rda5807_rds_rt_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct rda5807_driver *radio = dev_to_radio(dev);
+	ssize_t len;
+
+	mutex_lock(&radio->rds_lock);
+	len = sprintf(buf, "%s\n", radio->rds.rt);
+	mutex_unlock(&radio->rds_lock);
+	return len;
+}
+
+static ssize_t rda5807_rds_af_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct rda5807_driver *radio = dev_to_radio(dev);
+	ssize_t len = 0;
+	int i;
+
+	mutex_lock(&radio->rds_lock);
+	for (i = 0; i < radio->rds.af_count; i++)
+		len += sprintf(buf + len, "%s%u", i ? " " : "",
+			       radio->rds.af_khz[i]);
+	mutex_unlock(&radio->rds_lock);
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+
+static ssize_t rda5807_rds_ct_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct rda5807_driver *radio = dev_to_radio(dev);
+	struct rda5807_rds *rds = &radio->rds;
+	ssize_t len;
+	int offset;
+
+	mutex_lock(&radio->rds_lock);
+	if (!rds->ct_valid) {
+		len = sprintf(buf, "\n");
+	} else {
+		/* UTC and the local offset, e.g. "2012-06-01 12:30 +02:00" */
+		offset = rds->ct_offset;
+		len = sprintf(buf, "%04u-%02u-%02u %02u:%02u %c%02d:%02d\n",
+			      rds->ct_year, rds->ct_month, rds->ct_day,
+			      rds->ct_hour, rds->ct_minute,
+			      offset < 0 ? '-' : '+',
+			      abs(offset) / 2, (abs(offset) % 2) * 30);
+	}
+	mutex_unlock(&radio->rds_lock);
+	return len;
+}
+
+static ssize_t rda5807_rds_stats_show(struct device *dev,
+				      struct device_attribute *attr,
+				      char *buf)
+{
+	struct rda5807_driver *radio = dev_to_radio(dev);
+	ssize_t len;
+
+	mutex_lock(&radio->rds_lock);
+	len = sprintf(buf, "groups %u errors %u\n",
+		      radio->rds.groups, radio->rds.errors);
+	mutex_unlock(&radio->rds_lock);
+	return len;
+}
+
+static ssize_t rda5807_rds_af_mode_show(struct device *dev,
+					struct device_attribute *attr,
+					char *buf)
+{
+	return sprintf(buf, "%d\n", dev_to_radio(dev)->af.enabled);
+}
+
+static ssize_t rda5807_rds_af_mode_store(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	struct rda5807_driver *radio = dev_to_radio(dev);
+	unsigned int val;
+	int err;
+
+	err = kstrtouint(buf, 0, &val);
+	if (err)
+		return err;
+
+	radio->af.enabled = !!val;
+	return count;
+}
+
+static ssize_t rda5807_rds_af_threshold_show(struct device *dev,
+					     struct device_attribute *attr,
+					     char *buf)
+{
+	return sprintf(buf, "%u\n", dev_to_radio(dev)->af.threshold);
+}
+
+static ssize_t rda5807_rds_af_threshold_store(struct device *dev,
+					      struct device_attribute *attr,
+					      const char *buf, size_t count)
+{
+	struct rda5807_driver *radio = dev_to_radio(dev);
+	unsigned int val;
+	int err;
+
+	err = kstrtouint(buf, 0, &val);
+	if (err)
+		return err;
+	if (val > (RDA5807_MASK_RSSI >> RDA5807_SHIFT_RSSI))
+		return -ERANGE;
+
+	radio->af.threshold = val;
+	return count;
+}
+
+static ssize_t rda5807_rds_af_stats_show(struct device *dev,
+					 struct device_attribute *attr,
+					 char *buf)
+{
+	struct rda5807_af *af = &dev_to_radio(dev)->af;
+
+	return sprintf(buf, "attempts %u switches %u pi_mismatch %u "
+		       "no_better %u gap_us %u/%u latency_us %u/%u\n",
+		       af->attempts, af->switches, af->pi_mismatch,
+		       af->no_better, af->last_gap_us, af->max_gap_us,
+		       af->last_latency_us, af->max_latency_us);
+}
+
+static DEVICE_ATTR(rds_version, S_IRUGO, rda5807_rds_version_show, NULL);
+static DEVICE_ATTR(rds_pi, S_IRUGO, rda5807_rds_pi_show, NULL);
+static DEVICE_ATTR(rds_pty, S_IRUGO, rda5807_rds_pty_show, NULL);
+static DEVICE_ATTR(rds_ps, S_IRUGO, rda5807_rds_ps_show, NULL);
+static DEVICE_ATTR(rds_rt, S_IRUGO, rda5807_rds_rt_show, NULL);
+static DEVICE_ATTR(rds_af, S_IRUGO, rda5807_rds_af_show, NULL);
+static DEVICE_ATTR(rds_ct, S_IRUGO, rda5807_rds_ct_show, NULL);
+static DEVICE_ATTR(rds_stats, S_IRUGO, rda5807_rds_stats_show, NULL);
+static DEVICE_ATTR(rds_af_mode, S_IRUGO | S_IWUSR,
+		   rda5807_rds_af_mode_show, rda5807_rds_af_mode_store);
+static DEVICE_ATTR(rds_af_threshold, S_IRUGO | S_IWUSR,
+		   rda5807_rds_af_threshold_show,
+		   rda5807_rds_af_threshold_store);
+static DEVICE_ATTR(rds_af_stats, S_IRUGO, rda5807_rds_af_stats_show, NULL);
+
+static struct attribute *rda5807_rds_attrs[] = {
+	&dev_attr_rds_version.attr,
+	&dev_attr_rds_pi.attr,
+	&dev_attr_rds_pty.attr,
+	&dev_attr_rds_ps.attr,
+	&dev_attr_rds_rt.attr,
+	&dev_attr_rds_af.attr,
+	&dev_attr_rds_ct.attr,
+	&dev_attr_rds_stats.attr,
+	&dev_attr_rds_af_mode.attr,
+	&dev_attr_rds_af_threshold.attr,
+	&dev_attr_rds_af_stats.attr,
+	NULL,
+};
+
+static const struct attribute_group rda5807_rds_attr_group = {
+	.attrs = rda5807_rds_attrs,
+};
+
+#ifdef CONFIG_DEBUG_FS
+
+static int rda5807_i2c_stats_show(struct seq_file *m, void *unused)
+{
+	struct rda5807_driver *radio = m->private;
+	struct rda5807_i2c_stats *stats = &radio->i2c_stats;
+	u32 transfers, errors, min_us, max_us;
+	u64 bytes, call_us, elapsed_us;
+
+	spin_lock(&stats->lock);
+	transfers = stats->transfers;
+	errors = stats->errors;
+	bytes = stats->bytes;
+	call_us = stats->call_us;
+	min_us = stats->min_call_us;
+	max_us = stats->max_call_us;
+	spin_unlock(&stats->lock);
+	elapsed_us = ktime_to_us(ktime_sub(ktime_get(), stats->since));
+
+	seq_printf(m, "transfers: %u\n", transfers);
+	seq_printf(m, "errors: %u\n", errors);
+	seq_printf(m, "bytes: %llu\n", bytes);
+	seq_printf(m, "call_us: total %llu min %u max %u avg %llu\n",
+		   call_us, min_us, max_us,
+		   transfers ? div_u64(call_us, transfers) : 0);
+	/* share of wall time spent inside i2c_transfer(), per mille */
+	seq_printf(m, "in_call: %llu/1000\n",
+		   elapsed_us ? div64_u64(call_us * 1000, elapsed_us) : 0);
+	return 0;
+}
+
+static int rda5807_i2c_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rda5807_i2c_stats_show, inode->i_private);
+}
+
+static const struct file_operations rda5807_i2c_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rda5807_i2c_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void rda5807_debugfs_init(struct rda5807_driver *radio)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "rda5807-%s",
+		 dev_name(&radio->i2c_client->dev));
+	radio->debugfs = debugfs_create_dir(name, NULL);
+	if (IS_ERR_OR_NULL(radio->debugfs)) {
+		radio->debugfs = NULL;
+		return;
+	}
+	debugfs_create_file("i2c_stats", S_IRUGO, radio->debugfs, radio,
+			    &rda5807_i2c_stats_fops);
+}
+
+static void rda5807_debugfs_exit(struct rda5807_driver *radio)
+{
+	debugfs_remove_recursive(radio->debugfs);
+}
+
+#else
+
+static inline void rda5807_debugfs_init(struct rda5807_driver *radio)
+{
+}
+
+static inline void rda5807_debugfs_exit(struct rda5807_driver *radio)
+{
+}
+
+#endif
+
 static const struct v4l2_ioctl_ops rda5807_ioctl_ops = {
 	.vidioc_g_audio     = rda5807_vidioc_g_audio,
 	.vidioc_g_tuner     = rda5807_vidioc_g_tuner,
 	.vidioc_s_frequency = rda5807_vidioc_s_frequency,
 };
 
+#ifdef CONFIG_RADIO_RDA5807_I2S
+
+/*
+ * ASoC codec for the I2S output. The chip only transmits, so the DAI has
+ * a capture stream and no playback; the CPU side is the SoC I2S
+ * controller, which moves the samples to memory by DMA.
+ */
+
+static const struct {
+	unsigned int rate;
+	u16 sw_cnt;
+} rda5807_i2s_rates[] = {
+	{  8000, 0x0 },
+	{ 11025, 0x1 },
+	{ 12000, 0x2 },
+	{ 16000, 0x3 },
+	{ 22050, 0x4 },
+	{ 24000, 0x5 },
+	{ 32000, 0x6 },
+	{ 44100, 0x7 },
+	{ 48000, 0x8 },
+};
+
+static int rda5807_dai_set_fmt(struct snd_soc_dai *dai, unsigned int fmt)
+{
+	struct rda5807_driver *radio = snd_soc_dai_get_drvdata(dai);
+	u16 val = RDA5807_MASK_I2S_SIGNED;
+
+	switch (fmt & SND_SOC_DAIFMT_MASTER_MASK) {
+	case SND_SOC_DAIFMT_CBM_CFM:
+		break;
+	case SND_SOC_DAIFMT_CBS_CFS:
+		val |= RDA5807_MASK_I2S_SLAVE;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	switch (fmt & SND_SOC_DAIFMT_FORMAT_MASK) {
+	case SND_SOC_DAIFMT_I2S:
+		/* data starts one bit clock after the WS edge */
+		val |= RDA5807_MASK_I2S_L_DELY | RDA5807_MASK_I2S_R_DELY;
+		break;
+	case SND_SOC_DAIFMT_LEFT_J:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	switch (fmt & SND_SOC_DAIFMT_INV_MASK) {
+	case SND_SOC_DAIFMT_NB_NF:
+		break;
+	case SND_SOC_DAIFMT_IB_NF:
+		val |= RDA5807_MASK_I2S_SCLK_I_EDGE
+		     | RDA5807_MASK_I2S_SCLK_O_EDGE;
+		break;
+	case SND_SOC_DAIFMT_NB_IF:
+		val |= RDA5807_MASK_I2S_WS_I_EDGE | RDA5807_MASK_I2S_WS_O_EDGE;
+		break;
+	case SND_SOC_DAIFMT_IB_IF:
+		val |= RDA5807_MASK_I2S_SCLK_I_EDGE
+		     | RDA5807_MASK_I2S_SCLK_O_EDGE
+		     | RDA5807_MASK_I2S_WS_I_EDGE | RDA5807_MASK_I2S_WS_O_EDGE;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	dev_dbg(dai->dev, "set I2S format to %04X\n", val);
+	return rda5807_update_reg(radio, RDA5807_REG_I2S,
+				  RDA5807_MASK_I2S_FMT, val);
+}
+
+static int rda5807_dai_hw_params(struct snd_pcm_substream *substream,
+				 struct snd_pcm_hw_params *params,
+				 struct snd_soc_dai *dai)
+{
+	struct rda5807_driver *radio = snd_soc_dai_get_drvdata(dai);
+	unsigned int rate = params_rate(params);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(rda5807_i2s_rates); i++)
+		if (rda5807_i2s_rates[i].rate == rate)
+			break;
+	if (i == ARRAY_SIZE(rda5807_i2s_rates))
+		return -EINVAL;
+
+	dev_dbg(dai->dev, "set I2S rate to %u Hz\n", rate);
+	return rda5807_update_reg(radio, RDA5807_REG_I2S,
+				  RDA5807_MASK_I2S_SW_CNT,
+				  rda5807_i2s_rates[i].sw_cnt
+					<< RDA5807_SHIFT_I2S_SW_CNT);
+}
+
+static int rda5807_dai_startup(struct snd_pcm_substream *substream,
+			       struct snd_soc_dai *dai)
+{
+	struct rda5807_driver *radio = snd_soc_dai_get_drvdata(dai);
+
+	return rda5807_update_reg(radio, RDA5807_REG_IOCFG,
+				  RDA5807_MASK_I2S_ENABLE,
+				  RDA5807_MASK_I2S_ENABLE);
+}
+
+static void rda5807_dai_shutdown(struct snd_pcm_substream *substream,
+				 struct snd_soc_dai *dai)
+{
+	struct rda5807_driver *radio = snd_soc_dai_get_drvdata(dai);
+
+	rda5807_update_reg(radio, RDA5807_REG_IOCFG,
+			   RDA5807_MASK_I2S_ENABLE, 0);
+}
+
+static const struct snd_soc_dai_ops rda5807_dai_ops = {
+	.startup	= rda5807_dai_startup,
+	.shutdown	= rda5807_dai_shutdown,
+	.hw_params	= rda5807_dai_hw_params,
+	.set_fmt	= rda5807_dai_set_fmt,
+};
+
+static struct snd_soc_dai_driver rda5807_dai = {
+	.name = "rda5807-i2s",
+	.capture = {
+		.stream_name	= "Capture",
+		.channels_min	= 2,
+		.channels_max	= 2,
+		.rates		= SNDRV_PCM_RATE_8000_48000,
+		.formats	= SNDRV_PCM_FMTBIT_S16_LE,
+	},
+	.ops = &rda5807_dai_ops,
+};
+
+static struct snd_soc_codec_driver rda5807_codec_driver;
+
+static int rda5807_codec_register(struct i2c_client *client)
+{
+	return snd_soc_register_codec(&client->dev, &rda5807_codec_driver,
+				      &rda5807_dai, 1);
+}
+
+static void rda5807_codec_unregister(struct i2c_client *client)
+{
+	snd_soc_unregister_codec(&client->dev);
+}
+
+#else
+
+static inline int rda5807_codec_register(struct i2c_client *client)
+{
+	return 0;
+}
+
+static inline void rda5807_codec_unregister(struct i2c_client *client)
+{
+}
+
+#endif
+
 static int __devinit rda5807_i2c_probe(struct i2c_client *client,
 				       const struct i2c_device_id *id)
 {
@@ -369,6 +1617,16 @@ static int __devinit rda5807_i2c_probe(struct i2c_client *client,
 	}
 
 	radio->i2c_client = client;
+	spin_lock_init(&radio->i2c_stats.lock);
+	radio->i2c_stats.since = ktime_get();
+	mutex_init(&radio->lock);
+	mutex_init(&radio->rds_lock);
+	mutex_init(&radio->tune_lock);
+	radio->af.threshold = RDA5807_AF_THRESHOLD_DEFAULT;
+	INIT_DELAYED_WORK(&radio->rds_work, rda5807_rds_work);
+	init_completion(&radio->stc_done);
+	init_completion(&radio->rds_done);
+	rda5807_irq_init(radio);
 
 	/* Initialize controls. */
 	v4l2_ctrl_handler_init(&radio->ctrl_handler, 3);
@@ -414,12 +1672,32 @@ static int __devinit rda5807_i2c_probe(struct i2c_client *client,
 		goto err_video_unreg;
 	}
 
+	err = rda5807_codec_register(client);
+	if (err < 0) {
+		dev_warn(&client->dev, "Failed to register codec (%d)\n", err);
+		goto err_video_unreg;
+	}
+
+	err = sysfs_create_group(&client->dev.kobj, &rda5807_rds_attr_group);
+	if (err < 0) {
+		dev_warn(&client->dev, "Failed to create RDS attributes (%d)\n",
+				       err);
+		goto err_codec_unreg;
+	}
+
+	rda5807_debugfs_init(radio);
+
 	return 0;
 
+err_codec_unreg:
+	rda5807_codec_unregister(client);
+
 err_video_unreg:
 	video_unregister_device(&radio->video_dev);
+	cancel_delayed_work_sync(&radio->rds_work);
 
 err_ctrl_free:
+	rda5807_irq_exit(radio);
 	v4l2_ctrl_handler_free(&radio->ctrl_handler);
 
 /*err_radio_rel:*/
@@ -433,7 +1711,12 @@ static int __devexit rda5807_i2c_remove(struct i2c_client *client)
 {
 	struct rda5807_driver *radio = i2c_get_clientdata(client);
 
+	rda5807_debugfs_exit(radio);
+	sysfs_remove_group(&client->dev.kobj, &rda5807_rds_attr_group);
+	rda5807_codec_unregister(client);
 	video_unregister_device(&radio->video_dev);
+	rda5807_irq_exit(radio);
+	cancel_delayed_work_sync(&radio->rds_work);
 	v4l2_ctrl_handler_free(&radio->ctrl_handler);
 	video_device_release_empty(&radio->video_dev);
 	kfree(radio);
@@ -34,6 +34,10 @@
 #include <rtw_byteorder.h>
 
 #include <rtl8192c_hal.h>
+#include <linux/debugfs.h>
+#include <linux/proc_fs.h>
+#include <linux/kref.h>
+#include <asm/unaligned.h>
 #ifdef CONFIG_INTEL_PROXIM
 #include "../proxim/intel_proxim.h"	
 #endif
@@ -54,6 +58,878 @@ static u32 EDCAParam[maxAP][3] =
 //	{0x5e4322, 0x00a44f, 0x5ea44f}, //unknown AP
 };
 
+//============================================================
+// DM extension data
+//============================================================
+//
+// Per-adapter state of the mechanisms which are private to this file.
+// It is kept out of struct dm_priv so the shared HAL headers stay
+// untouched, and is found by adapter on a list private to this file.
+// It lives from rtl8192c_init_dm_priv() to rtl8192c_deinit_dm_priv().
+//
+#define DM_RF_SHADOW_REG_NUM	0x40	// RF address is 6 bits wide
+#define DM_RF_SHADOW_BIT(_n)	(((u64)1) << (_n))
+
+//
+// Shadow of the RF (LSSI) registers touched by the DM.
+// Every RF read costs several BB transactions (HSSI parameter read,
+// three writes to issue the read, PI mode read and read-back), which are
+// each a synchronous USB request on CU. The shadow keeps the HSSI
+// parameter images and the last value written to config registers, so
+// reads and read-modify-writes can skip the BB round trips. All of it is
+// dropped when the channel or bandwidth changes, since the channel
+// switch reprograms RF registers behind the DM.
+//
+typedef struct _DM_RF_SHADOW
+{
+	BOOLEAN		bValid;			// HSSI images captured
+	u8			Channel;		// channel and bandwidth of the capture
+	u8			ChannelBW;
+	u32			HSSIPara2[2];	// reg 0x824/0x82c image per path
+	u8			RfPiEnable[2];	// reg 0x820/0x828 BIT8 per path
+	u32			RegVal[2][DM_RF_SHADOW_REG_NUM];
+	u64			RegValid[2];	// bit n set: RegVal[path][n] is valid
+	u64			RegArmed[2];	// bit n set: trigger n re-armed on its last read
+
+	u32			TriggerCnt;
+	u32			TriggerSkipCnt;
+	u32			FastReadCnt;
+	u32			WriteSkipCnt;
+	u32			SavedIOCnt;		// BB transactions saved so far
+} DM_RF_SHADOW, *PDM_RF_SHADOW;
+
+//
+// EDCA turbo as a SoftAP.
+// Our TX is the clients' downlink, our RX their uplink. For downlink
+// heavy traffic the local BE parameters get a 3ms TXOP; for uplink heavy
+// traffic the AP backs off to leave the medium to the clients. Every
+// DM_EDCA_AP_PROBE_TICKS one turbo interval is run with the default
+// parameters instead, so the bytes moved with and without turbo can be
+// compared. That is the load the stations offered and got through, not
+// an airtime measurement: it does not separate a parameter effect from a
+// change in demand.
+//
+enum _DM_EDCA_AP_DIR
+{
+	DM_EDCA_AP_IDLE		= 0,
+	DM_EDCA_AP_BALANCED	= 1,
+	DM_EDCA_AP_UPLINK	= 2,
+	DM_EDCA_AP_DOWNLINK	= 3,
+	DM_EDCA_AP_DIR_NUM	= 4
+};
+
+#define DM_EDCA_AP_MIN_BYTES		(64 * 1024)		// per watchdog interval
+#define DM_EDCA_AP_PROBE_TICKS		16
+#define DM_EDCA_AP_BE_DL			0x5ea42b	// TXOP 3.008ms, CW 15-1023, AIFS 43us
+#define DM_EDCA_AP_BE_UL			0x00a44f	// no TXOP, CW 15-1023, AIFS 79us
+
+typedef struct _DM_EDCA_AP_TURBO
+{
+	u8			Dir;			// of the last interval
+	BOOLEAN		bOn;			// turbo parameters during the last interval
+	u8			ProbeTick;
+	BOOLEAN		bActive;		// run at least once since init
+
+	u32			DirTicks[DM_EDCA_AP_DIR_NUM];
+	u64			OnBytes[DM_EDCA_AP_DIR_NUM];
+	u32			OnTicks[DM_EDCA_AP_DIR_NUM];
+	u64			OffBytes[DM_EDCA_AP_DIR_NUM];
+	u32			OffTicks[DM_EDCA_AP_DIR_NUM];
+} DM_EDCA_AP_TURBO, *PDM_EDCA_AP_TURBO;
+
+//
+// DM tuning profiles.
+// Threshold sets which used to be selected at build time by board
+// ifdefs (CONFIG_SPECIAL_SETTING_FOR_FUNAI_TV). The active profile is
+// copied into the adapter's extension and can be switched at run time.
+//
+enum _DM_PROFILE_ID
+{
+	DM_PROFILE_THROUGHPUT	= 0,
+	DM_PROFILE_POWER		= 1,
+	DM_PROFILE_TV			= 2,	// static device, former FUNAI_TV setting
+	DM_PROFILE_MOBILE		= 3,
+	DM_PROFILE_MAX
+};
+
+typedef struct _DM_TUNING_PROFILE
+{
+	const char	*Name;
+
+	// DIG: move the IGI lower bound with the false alarm count
+	BOOLEAN		bDIGDynamicMin;
+	u8			DIGDynamicMinInit;
+	u16			DIGDynamicMinFA;
+
+	// BB RF_Save (88C): enter at >= RFSaveEnterRssi, leave at <= RFSaveLeaveRssi
+	u8			RFSaveEnterRssi;
+	u8			RFSaveLeaveRssi;
+} DM_TUNING_PROFILE, *PDM_TUNING_PROFILE;
+
+static const DM_TUNING_PROFILE DMProfileTable[DM_PROFILE_MAX] =
+{
+	//Name			DynMin	MinInit	MinFA	Enter	Leave
+	{"throughput",	_FALSE,	0x25,	500,	30,		25},
+	{"power",		_FALSE,	0x25,	500,	25,		20},
+	{"tv",			_TRUE,	0x25,	500,	50,		45},
+	{"mobile",		_FALSE,	0x25,	500,	40,		30},
+};
+
+#ifdef CONFIG_SPECIAL_SETTING_FOR_FUNAI_TV
+#define DM_PROFILE_DEFAULT		DM_PROFILE_TV
+#else
+#define DM_PROFILE_DEFAULT		DM_PROFILE_THROUGHPUT
+#endif
+
+//
+// TX power register images.
+// PHY_SetTxPowerLevel8192C() recomputes the TX AGC settings from the
+// EFUSE tables and writes them one dword at a time. Outside of a scan
+// and of BT coexistence, the result only depends on channel, bandwidth,
+// dynamic power level and the EFUSE regulatory mode, so it is captured
+// and replayed as a few burst writes afterwards. Capturing reads every
+// register back, so it is only done once a setting has missed twice:
+// one-off settings do not pay for an image never used.
+//
+#define DM_TXPWR_IMG_CH_NUM		14
+#define DM_TXPWR_IMG_BW_NUM		2		// HT_CHANNEL_WIDTH_20/40
+#define DM_TXPWR_IMG_LVL_NUM	3		// TxHighPwrLevel_Normal/Level1/Level2
+#define DM_TXPWR_IMG_DW_NUM		15
+
+typedef struct _DM_TXPWR_IMG_BLOCK
+{
+	u32		RegAddr;
+	u8		DwNum;
+} DM_TXPWR_IMG_BLOCK;
+
+// Contiguous ranges of the TX AGC registers of both paths.
+static const DM_TXPWR_IMG_BLOCK TxPwrImgBlock[] =
+{
+	{rTxAGC_A_Rate18_06,		3},		// 0xe00 - 0xe08
+	{rTxAGC_A_Mcs03_Mcs00,		4},		// 0xe10 - 0xe1c
+	{rTxAGC_B_Rate18_06,		4},		// 0x830 - 0x83c
+	{rTxAGC_B_Mcs07_Mcs04,		2},		// 0x848 - 0x84c
+	{rTxAGC_B_Mcs15_Mcs12,		2},		// 0x868 - 0x86c
+};
+
+typedef struct _DM_TXPWR_IMG_CACHE
+{
+	u8		Valid[DM_TXPWR_IMG_BW_NUM][DM_TXPWR_IMG_CH_NUM];	// bit per level
+	u8		Missed[DM_TXPWR_IMG_BW_NUM][DM_TXPWR_IMG_CH_NUM];	// bit per level, missed once
+	u32		Image[DM_TXPWR_IMG_BW_NUM][DM_TXPWR_IMG_CH_NUM][DM_TXPWR_IMG_LVL_NUM][DM_TXPWR_IMG_DW_NUM];
+	u8		CckIdx[DM_TXPWR_IMG_BW_NUM][DM_TXPWR_IMG_CH_NUM][DM_TXPWR_IMG_LVL_NUM];
+	u8		OfdmIdx[DM_TXPWR_IMG_BW_NUM][DM_TXPWR_IMG_CH_NUM][DM_TXPWR_IMG_LVL_NUM];
+	u8		Regulatory;		// EEPROMRegulatory the images were taken with
+} DM_TXPWR_IMG_CACHE, *PDM_TXPWR_IMG_CACHE;
+
+//
+// Dynamic A-MPDU limits.
+// The per rate group aggregation limits in REG_AGGLEN_LMT and the MPDU
+// density in REG_AMPDU_MIN_SPACE are tightened when the PWDB or the
+// false alarm rate show a degraded link and given back when it is clean
+// again. Block ack sessions are left
+// alone, only the size of what we aggregate changes. The values the
+// HAL programmed after association are the upper bound. They are read
+// once per association; after that the DM is the only writer and works
+// from its own copy.
+//
+typedef enum _DM_AMPDU_LEVEL
+{
+	DM_AMPDU_LEVEL_LARGE = 0,	// HAL negotiated limits
+	DM_AMPDU_LEVEL_MID,
+	DM_AMPDU_LEVEL_SMALL,
+	DM_AMPDU_LEVEL_NUM
+} DM_AMPDU_LEVEL;
+
+#define DM_AMPDU_UPGRADE_TICKS	2		// clean ticks needed before growing again
+
+typedef struct _DM_AMPDU_CTRL
+{
+	BOOLEAN		bBaseValid;
+	u8			Bssid[ETH_ALEN];	// association the base was read for
+	u32			BaseAggLen;			// REG_AGGLEN_LMT as set by the HAL
+	u8			BaseMinSpace;		// REG_AMPDU_MIN_SPACE[2:0] as set by the HAL
+	u8			MinSpaceHigh;		// REG_AMPDU_MIN_SPACE[7:3], kept as is
+	u32			CurAggLen;			// last values written by the DM
+	u8			CurMinSpace;
+	u8			Level;
+	u8			CleanTicks;
+
+	u32			LevelTicks[DM_AMPDU_LEVEL_NUM];
+	u32			LevelChangeCnt;
+} DM_AMPDU_CTRL, *PDM_AMPDU_CTRL;
+
+//
+// Traffic weighted PWDB for DIG.
+// With several stations DIG follows the weakest one, even when it is
+// idle. Optionally the PWDB at a percentile of the traffic is used
+// instead: stations are weighted by the bytes they moved in the last
+// watchdog interval, so an idle far client stops holding IGI down.
+//
+#define DM_DIG_WEIGHT_MACID_NUM		32
+
+typedef struct _DM_DIG_WEIGHT
+{
+	u8		Percentile;			// 0: off, use the weakest station
+	u8		SampleCnt;
+	u8		SamplePwdb[DM_DIG_WEIGHT_MACID_NUM];
+	u32		SampleWeight[DM_DIG_WEIGHT_MACID_NUM];
+	u64		LastBytes[DM_DIG_WEIGHT_MACID_NUM];
+	u32		SeenMask;			// MACIDs with a valid LastBytes
+	u32		TickMask;			// MACIDs sampled this interval
+	int		WeightedPWDB;		// 0 when no station moved traffic
+	u32		UsedCnt;
+	u32		FallbackCnt;
+} DM_DIG_WEIGHT, *PDM_DIG_WEIGHT;
+
+//
+// False alarm rate.
+// The BB false alarm counters are read and cleared only from the
+// watchdog tick, in the cmd thread, so they are serialised with LPS
+// and channel changes. Rates are normalised per second of the period
+// actually covered and Cnt_all to the nominal watchdog period. The
+// 16 bit counters (CCK: two bytes) may saturate under heavy
+// interference; such periods are counted, a saturated count is already
+// above the highest DIG threshold.
+//
+#define DM_FA_CNT_LIMIT			0xffff
+#define DM_FA_NOMINAL_MS		2000		// watchdog period the DIG thresholds assume
+
+typedef struct _DM_FA_SAMPLE
+{
+	u32					LastTime;		// rtw_get_current_time() of the period start
+	u32					IntervalMs;
+
+	u32					SatCnt;			// periods with a counter at its limit
+	u32					AllPerSec;
+	u32					OfdmPerSec;
+	u32					CckPerSec;
+} DM_FA_SAMPLE, *PDM_FA_SAMPLE;
+
+//
+// Automatic channel selection for SoftAP.
+// Each 2.4GHz channel is visited with a fixed IGI for DwellMs and its
+// false alarms are counted by category. The FA rate converts to CCA
+// busy time, the scanned BSSs (co-channel fully, overlapping channels
+// partially) to beacon airtime, and the channel with the most usable
+// airtime left wins. Surveys run in the watchdog tick, one channel per
+// tick, so they are serialised with channel switches and scans in the
+// cmd thread. A visit saves the channel and TXPAUSE, measures, and puts
+// both back within the same tick. Each visit needs the dongle idle: no
+// interface beaconing, linked or scanning. Otherwise the survey starts
+// over once idle again. The best channel is reported with a KOBJ_CHANGE
+// uevent (RTW_ACS_CHANNEL=<ch>) on the netdev, for the SoftAP setup.
+//
+#define DM_ACS_CH_NUM			13
+#define DM_ACS_IGI				0x30
+#define DM_ACS_DWELL_MS_DEFAULT	100
+#define DM_ACS_DWELL_MS_MAX		1000
+#define DM_ACS_OFDM_FA_US		20		// CCA busy per OFDM false alarm
+#define DM_ACS_CCK_FA_US		96		// CCA busy per CCK false alarm, short preamble
+#define DM_ACS_BSS_PERMILLE		24		// beacon airtime of a BSS at 1Mbps
+#define DM_ACS_STRONG_RSSI		(-70)	// dBm, BSS counted fully above
+
+typedef struct _DM_ACS_CH
+{
+	u32			OfdmFAPerSec;
+	u32			CckFAPerSec;
+	u32			FaParity;
+	u32			FaRateIllegal;
+	u32			FaCrc8;
+	u32			FaMcs;
+	u32			FaFastFsync;
+	u32			FaSbSearch;
+	u8			BssCnt;			// co-channel BSSs
+	u8			OverlapCnt;		// BSSs on channels within 4
+	s8			MaxRssi;		// dBm, co-channel
+	u16			FaBusy;			// permille
+	u16			BssBusy;		// permille
+	u16			Usable;			// permille
+} DM_ACS_CH, *PDM_ACS_CH;
+
+typedef struct _DM_ACS
+{
+	BOOLEAN				bPending;		// requested, waits for an idle tick
+	BOOLEAN				bRunning;
+	BOOLEAN				bAbort;			// drop the survey on the next tick
+	u8					NextCh;			// next channel to visit
+	u16					ChannelMask;	// BIT(ch-1) surveyed
+	u16					DwellMs;
+	u32					PeriodSec;		// 0: on request only
+	u32					Start;			// rtw_get_current_time() of the survey
+	u32					LastSurvey;		// rtw_get_current_time()
+	u8					BestChannel;	// of the last complete survey
+	u32					SurveyCnt;
+	u32					RestartCnt;		// surveys restarted for a busy dongle
+	u32					SurveyMs;		// duration of the last survey
+	DM_ACS_CH			Ch[DM_ACS_CH_NUM];
+} DM_ACS, *PDM_ACS;
+
+//
+// Per-station RSSI estimator.
+// Exponentially weighted mean and variance of each station's smoothed
+// PWDB, in fixed point. The hysteresis bands of DIG, CCK PD, RF_Save,
+// dynamic TX power and antenna diversity then scale with the measured
+// spread (Confidence/10 standard deviations) instead of a fixed dB gap:
+// fluctuating links stop toggling registers, steady ones move sooner.
+//
+#define DM_RSSI_EST_MACID_NUM		32
+#define DM_RSSI_EST_SHIFT			3		// EWMA weight 1/8
+#define DM_RSSI_EST_MIN_SAMPLES		4		// fixed gaps until then
+#define DM_RSSI_CONFIDENCE_DEFAULT	15		// 1.5 sigma
+
+typedef struct _DM_RSSI_EST
+{
+	int			MeanQ4;			// PWDB x16
+	u32			VarQ8;			// PWDB^2 x256
+	u32			Samples;
+} DM_RSSI_EST, *PDM_RSSI_EST;
+
+typedef struct _DM_RSSI_STAT
+{
+	u8			Confidence;		// sigma x10, 0: fixed gaps
+	u8			RefMacId;		// station the DM thresholds follow
+	u32			SeenMask;		// stations sampled this interval
+	int			RefPwdb;
+	DM_RSSI_EST	Sta[DM_RSSI_EST_MACID_NUM];
+	u32			AdaptCnt;		// margins taken from the estimate
+	u32			FixedCnt;
+} DM_RSSI_STAT, *PDM_RSSI_STAT;
+
+//
+// Shadow policies.
+// An alternate policy runs in the watchdog next to the active one, on
+// the same inputs, and only records the value it would have programmed.
+// It must not touch registers: its cost is the watchdog time it takes,
+// which is accounted along with how often and how far it diverges from
+// the active policy. That cost is wall-clock latency around the
+// evaluation, so interrupts and preemption in between are included.
+//
+typedef enum _DM_SHADOW_ID
+{
+	DM_SHADOW_DIG_FA = 0,		// IGI from false alarms only
+	DM_SHADOW_TXPWR_EARLY,		// dynamic TX power backing off earlier
+	DM_SHADOW_NUM
+} DM_SHADOW_ID;
+
+typedef struct _DM_SHADOW_STAT
+{
+	u32		State;				// policy private
+	u32		EvalCnt;
+	u32		DivergeCnt;
+	u32		LastShadow;
+	u32		LastActive;
+	u32		SumAbsDiff;
+	u32		MaxAbsDiff;
+	u64		LatencyNs;
+	u32		MaxLatencyNs;
+} DM_SHADOW_STAT, *PDM_SHADOW_STAT;
+
+//
+// Link degradation predictor.
+// In station mode a risk score is computed every tick, mostly from the
+// PWDB: its least squares slope over the last DM_LINK_PWDB_HISTORY
+// ticks and its level, with the false alarm rate as a minor term. There
+// is no TX retry input, the USB TX path does not report one. When the
+// score stays high an event is logged and counted, the early warning a
+// pre-scan and roam would need. Events are matched against the actual
+// link drops to measure how early they came.
+// Only a link which ends while the MLME link check is already missing
+// frames from the AP (mlme_ext_priv.retry) counts as a drop. Any other
+// end of the link, a local or user disconnect as much as a deauth the
+// DM cannot tell apart from one, is only counted as OtherEndCnt and
+// neither confirms nor refutes a pending event.
+//
+#define DM_LINK_PWDB_HISTORY		5
+#define DM_LINK_RISK_ENTER			60		// score raising the event
+#define DM_LINK_RISK_LEAVE			30		// score re-arming it
+#define DM_LINK_RISK_HOLD_TICKS		2
+#define DM_LINK_EVENT_TIMEOUT_MS	10000	// event not followed by a drop: false alarm
+
+typedef struct _DM_LINK_PREDICT
+{
+	BOOLEAN		bWasLinked;
+	u8			MissTicks;		// linked ticks with AP frames being missed
+	u8			PwdbHist[DM_LINK_PWDB_HISTORY];
+	u8			PwdbCnt;
+	u8			Score;
+	u8			HighTicks;
+	BOOLEAN		bEventPending;
+	u32			EventTime;		// rtw_get_current_time() of the event
+
+	u32			EventCnt;
+	u32			DropCnt;
+	u32			OtherEndCnt;
+	u32			PredictedDropCnt;
+	u32			FalseAlarmCnt;
+	u32			LastLeadMs;
+	u32			MinLeadMs;
+	u32			MaxLeadMs;
+	u32			SumLeadMs;
+} DM_LINK_PREDICT, *PDM_LINK_PREDICT;
+
+//
+// Dedicated DM thread, started and stopped with the "dm_thread" proc
+// setting. When started, rtl8192c_HalDmWatchDog() kicks the thread and
+// waits for the tick, so the DM with its synchronous USB I/O runs there
+// under its own scheduling class, priority and CPU while staying
+// serialised with the cmd thread. A tick still running after
+// DM_THREAD_KICK_TIMEOUT_MS is left to finish, and the kicks arriving
+// meanwhile are skipped. Kick-to-run latency and run time are kept.
+//
+#define DM_THREAD_CPU_ANY			(-1)
+#define DM_THREAD_KICK_TIMEOUT_MS	1000
+
+typedef struct _DM_THREAD
+{
+	struct task_struct	*Task;
+	int			Policy;			// SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+	int			Priority;		// rt priority, or nice for SCHED_NORMAL
+	int			Cpu;			// DM_THREAD_CPU_ANY for no affinity
+	_mutex		Lock;			// Task against kick, start and stop
+	atomic_t	Pending;
+	atomic_t	Busy;			// kicked and not done yet
+	struct completion	Done;
+	ktime_t		KickTime;
+
+	u32			KickCnt;
+	u32			RunCnt;
+	u32			TimeoutCnt;		// kicks given up waiting
+	u32			SkipCnt;		// kicks while a tick was still running
+	u32			LastLatencyUs;
+	u32			MaxLatencyUs;
+	u64			SumLatencyUs;
+	u32			LastRunUs;
+	u32			MaxRunUs;
+	u64			SumRunUs;
+} DM_THREAD, *PDM_THREAD;
+
+//
+// Per-tick telemetry ring.
+// A header followed by DM_TELEMETRY_REC_NUM fixed-size records, in a
+// vmalloc buffer userspace maps read-only through debugfs
+// (rtl8192c_dm-<ifname>/telemetry). The watchdog is the only writer.
+// Record n is written with Seq = 2n+1, then Seq = 2n+2 once complete,
+// then Head = n+1. A reader takes Head, reads the record at
+// (Head-1) % RecNum and accepts it if Seq is even and unchanged after
+// the copy.
+//
+#define DM_TELEMETRY_MAGIC		0x444d5452		// "DMTR"
+#define DM_TELEMETRY_VERSION	1
+#define DM_TELEMETRY_REC_NUM	1023			// header + records = 64KB
+
+#define DM_TELEMETRY_FLAG_DM_RUN	BIT(0)		// DM ran this tick
+#define DM_TELEMETRY_FLAG_LINKED	BIT(1)
+
+typedef struct _DM_TELEMETRY_HDR
+{
+	u32			Magic;
+	u16			Version;
+	u16			RecSize;
+	u32			RecNum;
+	u32			Head;			// records written so far
+	u32			Reserved[12];
+} DM_TELEMETRY_HDR, *PDM_TELEMETRY_HDR;
+
+typedef struct _DM_TELEMETRY_REC
+{
+	u32			Seq;
+	u32			TimeMs;
+	u32			FaParity;
+	u32			FaRateIllegal;
+	u32			FaCrc8;
+	u32			FaMcs;
+	u32			FaFastFsync;
+	u32			FaSbSearch;
+	u32			FaOfdm;
+	u32			FaCck;
+	u32			FaAll;
+	u8			CurIGValue;
+	u8			CckPdState;
+	u8			PwdbMin;
+	u8			PwdbMax;
+	u8			ThermalValue;
+	u8			TxPowerLevel;
+	u8			EdcaTurbo;
+	u8			EdcaTrafficIdx;
+	u8			RFState;
+	u8			CCAState;
+	u8			Flags;
+	u8			Reserved0;
+	u32			Reserved[2];
+} DM_TELEMETRY_REC, *PDM_TELEMETRY_REC;
+
+typedef struct _DM_TELEMETRY_RING
+{
+	struct kref			Ref;			// owner, open files and mappings
+	PDM_TELEMETRY_HDR	pHdr;
+	PDM_TELEMETRY_REC	pRec;
+	u32					Size;
+} DM_TELEMETRY_RING, *PDM_TELEMETRY_RING;
+
+struct dm_ext_priv
+{
+	_list			List;			// on dm_ext_list
+	PADAPTER		padapter;
+
+	DM_RF_SHADOW		RFShadow;
+	DM_EDCA_AP_TURBO	EdcaAP;
+
+	u8					ProfileId;
+	DM_TUNING_PROFILE	Profile;
+
+	PDM_TXPWR_IMG_CACHE	pTxPwrImg;		// allocated on first capture
+	u32					TxPwrImgHitCnt;
+	u32					TxPwrImgMissCnt;
+
+	DM_AMPDU_CTRL		Ampdu;
+
+	DM_DIG_WEIGHT		DigWeight;
+
+	DM_RSSI_STAT		RssiStat;
+
+	DM_FA_SAMPLE		FaSample;
+
+	DM_ACS				Acs;
+
+	u32					ShadowMask;		// BIT(DM_SHADOW_ID) of the policies run
+	DM_SHADOW_STAT		Shadow[DM_SHADOW_NUM];
+
+	DM_LINK_PREDICT		LinkPredict;
+
+	DM_THREAD			Thread;
+
+	BOOLEAN				bTelemetry;
+	PDM_TELEMETRY_RING	pTelemetry;		// allocated on first enable
+	struct dentry		*TelemetryDir;
+	struct dentry		*TelemetryFile;
+
+	char				ProcName[32];
+	struct proc_dir_entry	*ProcEntry;		// /proc/net/rtl8192c_dm-<ifname>
+};
+
+//
+// Defaults of the run-time settings. Applied once when the extension is
+// allocated, so settings survive the HAL DM re-init on interface up.
+//
+static void dm_ExtInitDefault(struct dm_ext_priv *pdmext)
+{
+	pdmext->ProfileId = DM_PROFILE_DEFAULT;
+	pdmext->Profile = DMProfileTable[DM_PROFILE_DEFAULT];
+
+	pdmext->RssiStat.Confidence = DM_RSSI_CONFIDENCE_DEFAULT;
+}
+
+static LIST_HEAD(dm_ext_list);
+static DEFINE_SPINLOCK(dm_ext_lock);
+
+static struct dm_ext_priv *GET_DM_EXT(PADAPTER Adapter)
+{
+	struct dm_ext_priv	*pdmext, *pFound = NULL;
+	_list	*plist;
+	unsigned long	flags;
+
+	spin_lock_irqsave(&dm_ext_lock, flags);
+	for(plist = get_next(&dm_ext_list); plist != &dm_ext_list; plist = get_next(plist))
+	{
+		pdmext = LIST_CONTAINOR(plist, struct dm_ext_priv, List);
+		if(pdmext->padapter == Adapter)
+		{
+			pFound = pdmext;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&dm_ext_lock, flags);
+
+	return pFound;
+}
+
+// Proc output is written with scnprintf(), so len never passes count - 1.
+#define DM_PROC_FULL(_len, _count)	((_len) >= (_count) - 1)
+
+//
+// Tuning profile of the adapter, the build default if none is allocated.
+//
+static const DM_TUNING_PROFILE *GET_DM_PROFILE(PADAPTER Adapter)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if(pdmext == NULL)
+		return &DMProfileTable[DM_PROFILE_DEFAULT];
+
+	return &pdmext->Profile;
+}
+
+
+//============================================================
+// RF register shadow
+//============================================================
+static u32
+dm_CalculateBitShift(
+	IN	u32		BitMask)
+{
+	u32	i;
+
+	for(i = 0; i <= 31; i++)
+	{
+		if(((BitMask>>i) & 0x1) == 1)
+			break;
+	}
+
+	return i;
+}
+
+//
+// Capture the HSSI parameter images used to issue LSSI reads.
+// Must be called again whenever the BB has been re-initialized.
+//
+static void
+dm_RFShadowInit(
+	IN	PADAPTER	Adapter)
+{
+	HAL_DATA_TYPE		*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_RF_SHADOW		pShadow;
+
+	if(pdmext == NULL)
+		return;
+	pShadow = &pdmext->RFShadow;
+
+	pShadow->HSSIPara2[RF_PATH_A] = PHY_QueryBBReg(Adapter, rFPGA0_XA_HSSIParameter2, bMaskDWord);
+	pShadow->RfPiEnable[RF_PATH_A] = (u8)PHY_QueryBBReg(Adapter, rFPGA0_XA_HSSIParameter1, BIT8);
+
+	if(IS_92C_SERIAL(pHalData->VersionID))
+	{
+		pShadow->HSSIPara2[RF_PATH_B] = PHY_QueryBBReg(Adapter, pHalData->PHYRegDef[RF_PATH_B].rfHSSIPara2, bMaskDWord);
+		pShadow->RfPiEnable[RF_PATH_B] = (u8)PHY_QueryBBReg(Adapter, rFPGA0_XB_HSSIParameter1, BIT8);
+	}
+
+	pShadow->RegValid[RF_PATH_A] = 0;
+	pShadow->RegValid[RF_PATH_B] = 0;
+	pShadow->RegArmed[RF_PATH_A] = 0;
+	pShadow->RegArmed[RF_PATH_B] = 0;
+	pShadow->Channel = pHalData->CurrentChannel;
+	pShadow->ChannelBW = (u8)pHalData->CurrentChannelBW;
+	pShadow->bValid = _TRUE;
+}
+
+//
+// Drop every cached value. Call this after anything which reprograms RF
+// registers behind the DM's back (calibration, channel switch, HAL init).
+//
+void
+rtl8192c_dm_RFShadowInvalidate(
+	IN	PADAPTER	Adapter)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if(pdmext == NULL)
+		return;
+
+	pdmext->RFShadow.bValid = _FALSE;
+	pdmext->RFShadow.RegValid[RF_PATH_A] = 0;
+	pdmext->RFShadow.RegValid[RF_PATH_B] = 0;
+	pdmext->RFShadow.RegArmed[RF_PATH_A] = 0;
+	pdmext->RFShadow.RegArmed[RF_PATH_B] = 0;
+}
+
+//
+// Re-capture after a channel or bandwidth switch done outside the DM.
+//
+static void
+dm_RFShadowCheck(
+	IN	PADAPTER		Adapter,
+	IN	PDM_RF_SHADOW	pShadow)
+{
+	HAL_DATA_TYPE		*pHalData = GET_HAL_DATA(Adapter);
+
+	if(pShadow->bValid &&
+		(pShadow->Channel != pHalData->CurrentChannel ||
+		pShadow->ChannelBW != (u8)pHalData->CurrentChannelBW))
+		rtl8192c_dm_RFShadowInvalidate(Adapter);
+
+	if(!pShadow->bValid)
+		dm_RFShadowInit(Adapter);
+}
+
+//
+// Same sequence as phy_RFSerialRead(), but the HSSI parameter register
+// contents come from the shadow instead of being read back each time.
+//
+static u32
+dm_RFShadowSerialRead(
+	IN	PADAPTER			Adapter,
+	IN	PDM_RF_SHADOW		pShadow,
+	IN	RF_RADIO_PATH_E	eRFPath,
+	IN	u32				Offset)
+{
+	HAL_DATA_TYPE				*pHalData = GET_HAL_DATA(Adapter);
+	BB_REGISTER_DEFINITION_T	*pPhyReg = &pHalData->PHYRegDef[eRFPath];
+	u32							tmplong, tmplong2;
+
+	Offset &= 0x3f;
+
+	tmplong = pShadow->HSSIPara2[RF_PATH_A];
+	tmplong2 = (pShadow->HSSIPara2[eRFPath] & (~bLSSIReadAddress)) | (Offset<<23) | bLSSIReadEdge;
+
+	PHY_SetBBReg(Adapter, rFPGA0_XA_HSSIParameter2, bMaskDWord, tmplong&(~bLSSIReadEdge));
+	rtw_udelay_os(10);
+	PHY_SetBBReg(Adapter, pPhyReg->rfHSSIPara2, bMaskDWord, tmplong2);
+	rtw_udelay_os(100);
+	PHY_SetBBReg(Adapter, rFPGA0_XA_HSSIParameter2, bMaskDWord, tmplong|bLSSIReadEdge);
+	rtw_udelay_os(10);
+
+	pShadow->FastReadCnt++;
+	pShadow->SavedIOCnt += (eRFPath == RF_PATH_A) ? 2 : 3;
+
+	if(pShadow->RfPiEnable[eRFPath])
+		return PHY_QueryBBReg(Adapter, pPhyReg->rfLSSIReadBackPi, bLSSIReadBackData);
+	else
+		return PHY_QueryBBReg(Adapter, pPhyReg->rfLSSIReadBack, bLSSIReadBackData);
+}
+
+//
+// Read an RF register. Config registers written through
+// dm_RFShadowSetRFReg() are served from the shadow without any I/O.
+//
+static u32
+dm_RFShadowQueryRFReg(
+	IN	PADAPTER			Adapter,
+	IN	RF_RADIO_PATH_E	eRFPath,
+	IN	u32				RegAddr,
+	IN	u32				BitMask)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_RF_SHADOW		pShadow;
+	u32					Readback_Value;
+
+	if(pdmext == NULL)
+		return PHY_QueryRFReg(Adapter, eRFPath, RegAddr, BitMask);
+	pShadow = &pdmext->RFShadow;
+	dm_RFShadowCheck(Adapter, pShadow);
+
+	RegAddr &= 0x3f;
+	if(pShadow->RegValid[eRFPath] & DM_RF_SHADOW_BIT(RegAddr))
+	{
+		pShadow->SavedIOCnt += 6;
+		Readback_Value = pShadow->RegVal[eRFPath][RegAddr];
+	}
+	else
+	{
+		Readback_Value = dm_RFShadowSerialRead(Adapter, pShadow, eRFPath, RegAddr);
+	}
+
+	return (Readback_Value & BitMask) >> dm_CalculateBitShift(BitMask);
+}
+
+//
+// Write an RF register through the shadow.
+// bTrigger marks registers whose write starts an action in the RF (e.g.
+// the thermal meter); those are never cached, since the hardware changes
+// their content afterwards, and only skipped when dm_RFShadowReadTrigger()
+// has already re-armed them.
+//
+static void
+dm_RFShadowSetRFReg(
+	IN	PADAPTER			Adapter,
+	IN	RF_RADIO_PATH_E	eRFPath,
+	IN	u32				RegAddr,
+	IN	u32				BitMask,
+	IN	u32				Data,
+	IN	BOOLEAN			bTrigger)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_RF_SHADOW		pShadow;
+	u32					Original_Value, NewValue;
+
+	if(pdmext == NULL)
+	{
+		PHY_SetRFReg(Adapter, eRFPath, RegAddr, BitMask, Data);
+		return;
+	}
+	pShadow = &pdmext->RFShadow;
+	dm_RFShadowCheck(Adapter, pShadow);
+
+	RegAddr &= 0x3f;
+	if(bTrigger)
+	{
+		pShadow->RegValid[eRFPath] &= ~DM_RF_SHADOW_BIT(RegAddr);
+		if(pShadow->RegArmed[eRFPath] & DM_RF_SHADOW_BIT(RegAddr))
+		{
+			pShadow->RegArmed[eRFPath] &= ~DM_RF_SHADOW_BIT(RegAddr);
+			pShadow->TriggerSkipCnt++;
+			pShadow->SavedIOCnt++;
+			return;
+		}
+		pShadow->TriggerCnt++;
+		PHY_SetRFReg(Adapter, eRFPath, RegAddr, BitMask, Data);
+		return;
+	}
+
+	if(BitMask == bRFRegOffsetMask)
+	{
+		NewValue = Data;
+	}
+	else if(pShadow->RegValid[eRFPath] & DM_RF_SHADOW_BIT(RegAddr))
+	{
+		// Read-modify-write from the shadow, no LSSI read needed.
+		Original_Value = pShadow->RegVal[eRFPath][RegAddr];
+		NewValue = (Original_Value & ~BitMask) | ((Data << dm_CalculateBitShift(BitMask)) & BitMask);
+		pShadow->SavedIOCnt += 6;
+	}
+	else
+	{
+		Original_Value = dm_RFShadowQueryRFReg(Adapter, eRFPath, RegAddr, bRFRegOffsetMask);
+		NewValue = (Original_Value & ~BitMask) | ((Data << dm_CalculateBitShift(BitMask)) & BitMask);
+	}
+
+	if((pShadow->RegValid[eRFPath] & DM_RF_SHADOW_BIT(RegAddr)) &&
+		(pShadow->RegVal[eRFPath][RegAddr] == NewValue))
+	{
+		pShadow->WriteSkipCnt++;
+		pShadow->SavedIOCnt++;
+		return;
+	}
+
+	PHY_SetRFReg(Adapter, eRFPath, RegAddr, bRFRegOffsetMask, NewValue);
+	pShadow->RegVal[eRFPath][RegAddr] = NewValue;
+	pShadow->RegValid[eRFPath] |= DM_RF_SHADOW_BIT(RegAddr);
+}
+
+//
+// Read the result of a trigger register and start the next measurement
+// in the same sequence. The next trigger write through
+// dm_RFShadowSetRFReg() is then skipped, so a measurement cycle costs
+// one LSSI read and one LSSI write in a single watchdog tick.
+//
+static u32
+dm_RFShadowReadTrigger(
+	IN	PADAPTER			Adapter,
+	IN	RF_RADIO_PATH_E	eRFPath,
+	IN	u32				RegAddr,
+	IN	u32				BitMask,
+	IN	u32				TriggerData)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_RF_SHADOW		pShadow;
+	u32					Readback_Value;
+
+	if(pdmext == NULL)
+		return PHY_QueryRFReg(Adapter, eRFPath, RegAddr, BitMask);
+	pShadow = &pdmext->RFShadow;
+	dm_RFShadowCheck(Adapter, pShadow);
+
+	RegAddr &= 0x3f;
+	Readback_Value = dm_RFShadowSerialRead(Adapter, pShadow, eRFPath, RegAddr);
+
+	PHY_SetRFReg(Adapter, eRFPath, RegAddr, bRFRegOffsetMask, TriggerData);
+	pShadow->TriggerCnt++;
+	pShadow->RegValid[eRFPath] &= ~DM_RF_SHADOW_BIT(RegAddr);
+	pShadow->RegArmed[eRFPath] |= DM_RF_SHADOW_BIT(RegAddr);
+
+	return (Readback_Value & BitMask) >> dm_CalculateBitShift(BitMask);
+}
+
 
 /*-----------------------------------------------------------------------------
  * Function:	dm_DIGInit()
@@ -109,28 +985,354 @@ static void	dm_DIGInit(
 	pDigTable->ForbiddenIGI = DM_DIG_MIN;
 	pDigTable->LargeFAHit = 0;
 	pDigTable->Recover_cnt = 0;
-	pdmpriv->DIG_Dynamic_MIN  = 0x25; //for FUNAI_TV
+	pdmpriv->DIG_Dynamic_MIN  = GET_DM_PROFILE(pAdapter)->DIGDynamicMinInit;
+}
+
+//
+// Description:
+//		Switch the DM tuning profile of an interface at run time.
+//		Profile thresholds take effect from the next watchdog tick.
+//
+static int
+dm_SetProfile(
+	IN	PADAPTER	Adapter,
+	IN	u8			ProfileId
+	)
+{
+	HAL_DATA_TYPE		*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv		*pdmpriv = &pHalData->dmpriv;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if(pdmext == NULL)
+		return _FAIL;
+
+	if(ProfileId >= DM_PROFILE_MAX)
+		return _FAIL;
+
+	pdmext->ProfileId = ProfileId;
+	pdmext->Profile = DMProfileTable[ProfileId];
+	pdmpriv->DIG_Dynamic_MIN = pdmext->Profile.DIGDynamicMinInit;
+
+	DBG_8192C("%s: DM profile %s\n", __FUNCTION__, pdmext->Profile.Name);
+
+	return _SUCCESS;
+}
+
+static int
+dm_SetProfileByName(
+	IN	PADAPTER	Adapter,
+	IN	const char	*Name
+	)
+{
+	u8	i;
+
+	for(i = 0; i < DM_PROFILE_MAX; i++)
+	{
+		if(strcmp(DMProfileTable[i].Name, Name) == 0)
+			return dm_SetProfile(Adapter, i);
+	}
+
+	return _FAIL;
+}
+
+
+//============================================================
+// Traffic weighted PWDB for DIG
+//============================================================
+static void
+dm_DIGWeightBegin(
+	IN	PADAPTER	Adapter)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if(pdmext)
+	{
+		pdmext->DigWeight.SampleCnt = 0;
+		pdmext->DigWeight.TickMask = 0;
+	}
+}
+
+static void
+dm_DIGWeightAddSta(
+	IN	PADAPTER	Adapter,
+	IN	u8			MacId,
+	IN	int			Pwdb,
+	IN	u64			Bytes)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_DIG_WEIGHT		pWeight;
+	u64	Delta;
+	u8	i;
+
+	if((pdmext == NULL) || (MacId >= DM_DIG_WEIGHT_MACID_NUM))
+		return;
+	pWeight = &pdmext->DigWeight;
+
+	// First sample of a station, or MACID reused by a new one whose
+	// counters restarted: only seed LastBytes, it moved nothing yet.
+	if(!(pWeight->SeenMask & BIT(MacId)) || (Bytes < pWeight->LastBytes[MacId]))
+		Delta = 0;
+	else
+		Delta = Bytes - pWeight->LastBytes[MacId];
+	pWeight->LastBytes[MacId] = Bytes;
+	pWeight->TickMask |= BIT(MacId);
+	if(Delta > 0x7fffffff)
+		Delta = 0x7fffffff;
+
+	if(pWeight->SampleCnt >= DM_DIG_WEIGHT_MACID_NUM)
+		return;
+
+	// Keep the samples sorted by PWDB.
+	i = pWeight->SampleCnt;
+	while((i > 0) && (pWeight->SamplePwdb[i-1] > Pwdb))
+	{
+		pWeight->SamplePwdb[i] = pWeight->SamplePwdb[i-1];
+		pWeight->SampleWeight[i] = pWeight->SampleWeight[i-1];
+		i--;
+	}
+	pWeight->SamplePwdb[i] = (u8)Pwdb;
+	pWeight->SampleWeight[i] = (u32)Delta;
+	pWeight->SampleCnt++;
 }
 
+static void
+dm_DIGWeightEnd(
+	IN	PADAPTER	Adapter)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_DIG_WEIGHT		pWeight;
+	u64	Total = 0, Cum = 0;
+	u8	i;
+
+	if(pdmext == NULL)
+		return;
+	pWeight = &pdmext->DigWeight;
+
+	// A station missing for a whole interval is seeded again.
+	pWeight->SeenMask = pWeight->TickMask;
+
+	pWeight->WeightedPWDB = 0;
+	if((pWeight->Percentile == 0) || (pWeight->SampleCnt == 0))
+		return;
+
+	for(i = 0; i < pWeight->SampleCnt; i++)
+		Total += pWeight->SampleWeight[i];
+
+	for(i = 0; (Total != 0) && (i < pWeight->SampleCnt); i++)
+	{
+		Cum += pWeight->SampleWeight[i];
+		if(Cum * 100 >= Total * pWeight->Percentile)
+		{
+			pWeight->WeightedPWDB = pWeight->SamplePwdb[i];
+			break;
+		}
+	}
+
+	// Counted once per watchdog interval.
+	if(pWeight->WeightedPWDB == 0)
+		pWeight->FallbackCnt++;
+	else
+		pWeight->UsedCnt++;
+}
+
+//
+// PWDB of the associated entries as seen by DIG: the traffic weighted
+// percentile cached by dm_DIGWeightEnd() when enabled and there was
+// traffic, the weakest entry otherwise.
+//
+static int
+dm_DIGEntryPWDB(
+	IN	PADAPTER	Adapter)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
 
+	if((pdmext == NULL) || (pdmext->DigWeight.Percentile == 0) ||
+		(pdmext->DigWeight.WeightedPWDB == 0) ||
+		(pdmpriv->EntryMinUndecoratedSmoothedPWDB == 0))
+		return pdmpriv->EntryMinUndecoratedSmoothedPWDB;
+
+	return pdmext->DigWeight.WeightedPWDB;
+}
+
+//
+// Description:
+//		Percentile of the traffic whose PWDB DIG follows with several
+//		stations, 0 to follow the weakest station.
+//
+static int
+dm_SetDIGWeightedPercentile(
+	IN	PADAPTER	Adapter,
+	IN	u8			Percentile
+	)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if((pdmext == NULL) || (Percentile > 100))
+		return _FAIL;
+
+	pdmext->DigWeight.Percentile = Percentile;
+	return _SUCCESS;
+}
+
+//============================================================
+// Per-station RSSI estimator
+//============================================================
+static void
+dm_RssiEstBegin(
+	IN	PADAPTER	Adapter)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if(pdmext == NULL)
+		return;
+
+	pdmext->RssiStat.SeenMask = 0;
+	pdmext->RssiStat.RefPwdb = 0xff;
+}
+
+static void
+dm_RssiEstAddSta(
+	IN	PADAPTER	Adapter,
+	IN	u8			MacId,
+	IN	int			Pwdb)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_RSSI_STAT	pStat;
+	PDM_RSSI_EST	pEst;
+	int		Diff;
+
+	if((pdmext == NULL) || (MacId >= DM_RSSI_EST_MACID_NUM))
+		return;
+	pStat = &pdmext->RssiStat;
+	pEst = &pStat->Sta[MacId];
+
+	if(pEst->Samples == 0)
+	{
+		pEst->MeanQ4 = Pwdb << 4;
+		pEst->VarQ8 = 0;
+	}
+	else
+	{
+		Diff = (Pwdb << 4) - pEst->MeanQ4;
+		pEst->MeanQ4 += Diff / (1 << DM_RSSI_EST_SHIFT);
+		pEst->VarQ8 = (u32)((int)pEst->VarQ8 +
+			((Diff * Diff) - (int)pEst->VarQ8) / (1 << DM_RSSI_EST_SHIFT));
+	}
+	pEst->Samples++;
+
+	pStat->SeenMask |= BIT(MacId);
+
+	// The DM thresholds follow the weakest station.
+	if(Pwdb < pStat->RefPwdb)
+	{
+		pStat->RefPwdb = Pwdb;
+		pStat->RefMacId = MacId;
+	}
+}
+
+static void
+dm_RssiEstEnd(
+	IN	PADAPTER	Adapter)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	u8	i;
+
+	if(pdmext == NULL)
+		return;
+
+	// Gone stations: a new one may get the MACID.
+	for(i = 0; i < DM_RSSI_EST_MACID_NUM; i++)
+	{
+		if(!(pdmext->RssiStat.SeenMask & BIT(i)))
+			pdmext->RssiStat.Sta[i].Samples = 0;
+	}
+}
+
+//
+// Description:
+//		Hysteresis band, in dB, below an upper threshold the DM state
+//		has to fall before it changes back. FixedGap when there is no
+//		reliable estimate or the confidence is 0.
+//
+static int
+dm_RssiMargin(
+	IN	PADAPTER	Adapter,
+	IN	int			FixedGap)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_RSSI_STAT	pStat;
+	PDM_RSSI_EST	pEst;
+	int		Margin;
+
+	if(pdmext == NULL)
+		return FixedGap;
+	pStat = &pdmext->RssiStat;
+	pEst = &pStat->Sta[pStat->RefMacId];
+
+	if((pStat->Confidence == 0) || (pEst->Samples < DM_RSSI_EST_MIN_SAMPLES))
+	{
+		pStat->FixedCnt++;
+		return FixedGap;
+	}
+
+	// sigma is sqrt(VarQ8) in Q4; round to dB.
+	Margin = ((int)int_sqrt(pEst->VarQ8) * pStat->Confidence / 10 + 8) >> 4;
+	if(Margin < 1)
+		Margin = 1;
+	if(Margin > (FixedGap * 2))
+		Margin = FixedGap * 2;
+
+	pStat->AdaptCnt++;
+	return Margin;
+}
+
+//
+// Description:
+//		Width of the RSSI hysteresis bands in standard deviations x10,
+//		0 to use the fixed dB gaps.
+//
+static int
+dm_SetRssiConfidence(
+	IN	PADAPTER	Adapter,
+	IN	u8			Confidence
+	)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if((pdmext == NULL) || (Confidence > 50))
+		return _FAIL;
+
+	pdmext->RssiStat.Confidence = Confidence;
+	return _SUCCESS;
+}
+
+//
+// bWeighted: DIG may follow the traffic weighted entry PWDB, CCK PD
+// always keeps the weakest entry.
+//
 static u8 dm_initial_gain_MinPWDB(
-	IN	PADAPTER	pAdapter
+	IN	PADAPTER	pAdapter,
+	IN	BOOLEAN		bWeighted
 	)
 {
 	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(pAdapter);
 	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
 	DIG_T			*pDigTable = &pdmpriv->DM_DigTable;
 	int	Rssi_val_min = 0;
+	int	EntryPWDB = bWeighted ? dm_DIGEntryPWDB(pAdapter) :
+				pdmpriv->EntryMinUndecoratedSmoothedPWDB;
 	
 	if((pDigTable->CurMultiSTAConnectState == DIG_MultiSTA_CONNECT) &&
 		(pDigTable->CurSTAConnectState == DIG_STA_CONNECT) )
 	{
-		if(pdmpriv->EntryMinUndecoratedSmoothedPWDB != 0)
+		if(EntryPWDB != 0)
 #ifdef CONFIG_CONCURRENT_MODE
-			Rssi_val_min  =  (pdmpriv->UndecoratedSmoothedPWDB+pdmpriv->EntryMinUndecoratedSmoothedPWDB)/2;
+			Rssi_val_min  =  (pdmpriv->UndecoratedSmoothedPWDB+EntryPWDB)/2;
 #else
-			Rssi_val_min  =  (pdmpriv->EntryMinUndecoratedSmoothedPWDB > pdmpriv->UndecoratedSmoothedPWDB)?
-					pdmpriv->UndecoratedSmoothedPWDB:pdmpriv->EntryMinUndecoratedSmoothedPWDB;		
+			Rssi_val_min  =  (EntryPWDB > pdmpriv->UndecoratedSmoothedPWDB)?
+					pdmpriv->UndecoratedSmoothedPWDB:EntryPWDB;		
 #endif //CONFIG_CONCURRENT_MODE
 		else
 			Rssi_val_min = pdmpriv->UndecoratedSmoothedPWDB;
@@ -139,7 +1341,7 @@ static u8 dm_initial_gain_MinPWDB(
 			pDigTable->CurSTAConnectState == DIG_STA_BEFORE_CONNECT) 
 		Rssi_val_min = pdmpriv->UndecoratedSmoothedPWDB;
 	else if(pDigTable->CurMultiSTAConnectState == DIG_MultiSTA_CONNECT)
-		Rssi_val_min = pdmpriv->EntryMinUndecoratedSmoothedPWDB;
+		Rssi_val_min = EntryPWDB;
 
 	//printk("%s CurMultiSTAConnectState(0x%02x) UndecoratedSmoothedPWDB(%d),EntryMinUndecoratedSmoothedPWDB(%d)\n"
 	//,__FUNCTION__,pDigTable->CurSTAConnectState,
@@ -149,18 +1351,17 @@ static u8 dm_initial_gain_MinPWDB(
 }
 
 
-static VOID 
-dm_FalseAlarmCounterStatistics(
-	IN	PADAPTER	Adapter
-	)
+//
+// Read and clear the BB false alarm counters into FalseAlmCnt. Returns
+// the largest single counter, to spot saturation.
+//
+static u32
+dm_FAReadCounters(
+	IN	PADAPTER				Adapter,
+	IN	PFALSE_ALARM_STATISTICS	FalseAlmCnt)
 {
 	u32 ret_value;
-	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
-	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
-	PFALSE_ALARM_STATISTICS FalseAlmCnt = &(pdmpriv->FalseAlmCnt);
-#ifdef CONFIG_CONCURRENT_MODE
-	PADAPTER pbuddy_adapter = Adapter->pbuddy_adapter;
-#endif //CONFIG_CONCURRENT_MODE
+	u32	Peak;
 	
 	ret_value = PHY_QueryBBReg(Adapter, rOFDM_PHYCounter1, bMaskDWord);
        FalseAlmCnt->Cnt_Parity_Fail = ((ret_value&0xffff0000)>>16);	
@@ -173,11 +1374,6 @@ dm_FalseAlarmCounterStatistics(
 	ret_value = PHY_QueryBBReg(Adapter, rOFDM0_FrameSync, bMaskDWord);
 	FalseAlmCnt->Cnt_Fast_Fsync = (ret_value&0xffff);
 	FalseAlmCnt->Cnt_SB_Search_fail = ((ret_value&0xffff0000)>>16);
-
-	FalseAlmCnt->Cnt_Ofdm_fail = 	FalseAlmCnt->Cnt_Parity_Fail + FalseAlmCnt->Cnt_Rate_Illegal +
-								FalseAlmCnt->Cnt_Crc8_fail + FalseAlmCnt->Cnt_Mcs_fail+
-								FalseAlmCnt->Cnt_Fast_Fsync + FalseAlmCnt->Cnt_SB_Search_fail;
-
 	
 	//hold cck counter
 	PHY_SetBBReg(Adapter, rCCK0_FalseAlarmReport, BIT(14), 1);
@@ -187,6 +1383,87 @@ dm_FalseAlarmCounterStatistics(
 
 	ret_value = PHY_QueryBBReg(Adapter, rCCK0_FACounterUpper, bMaskByte3);
 	FalseAlmCnt->Cnt_Cck_fail +=  (ret_value& 0xff)<<8;
+
+	//reset false alarm counter registers
+	PHY_SetBBReg(Adapter, rOFDM1_LSTF, 0x08000000, 1);
+	PHY_SetBBReg(Adapter, rOFDM1_LSTF, 0x08000000, 0);
+	//reset cck counter
+	PHY_SetBBReg(Adapter, rCCK0_FalseAlarmReport, 0x0000c000, 0);
+	//enable cck counter
+	PHY_SetBBReg(Adapter, rCCK0_FalseAlarmReport, 0x0000c000, 2);
+
+	Peak = FalseAlmCnt->Cnt_Cck_fail;
+	if(FalseAlmCnt->Cnt_Parity_Fail > Peak)
+		Peak = FalseAlmCnt->Cnt_Parity_Fail;
+	if(FalseAlmCnt->Cnt_Rate_Illegal > Peak)
+		Peak = FalseAlmCnt->Cnt_Rate_Illegal;
+	if(FalseAlmCnt->Cnt_Crc8_fail > Peak)
+		Peak = FalseAlmCnt->Cnt_Crc8_fail;
+	if(FalseAlmCnt->Cnt_Mcs_fail > Peak)
+		Peak = FalseAlmCnt->Cnt_Mcs_fail;
+	if(FalseAlmCnt->Cnt_Fast_Fsync > Peak)
+		Peak = FalseAlmCnt->Cnt_Fast_Fsync;
+	if(FalseAlmCnt->Cnt_SB_Search_fail > Peak)
+		Peak = FalseAlmCnt->Cnt_SB_Search_fail;
+
+	return Peak;
+}
+
+static void
+dm_FASampleInit(
+	IN	PDM_FA_SAMPLE	pSample)
+{
+	pSample->IntervalMs = DM_FA_NOMINAL_MS;
+}
+
+//
+// End of a watchdog period: note saturation and the length of the
+// period the counters covered.
+//
+static void
+dm_FASampleEnd(
+	IN	PDM_FA_SAMPLE			pSample,
+	IN	u32						Peak)
+{
+	u32		Now = rtw_get_current_time();
+	u32		IntervalMs;
+
+	if(Peak >= DM_FA_CNT_LIMIT)
+		pSample->SatCnt++;
+
+	// Period actually covered, the nominal one on the first call.
+	IntervalMs = (pSample->LastTime) ? rtw_get_passing_time_ms(pSample->LastTime) : 0;
+	if((IntervalMs < DM_FA_NOMINAL_MS / 4) || (IntervalMs > DM_FA_NOMINAL_MS * 8))
+		IntervalMs = DM_FA_NOMINAL_MS;
+	pSample->LastTime = Now;
+	pSample->IntervalMs = IntervalMs;
+}
+
+static VOID 
+dm_FalseAlarmCounterStatistics(
+	IN	PADAPTER	Adapter
+	)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	PFALSE_ALARM_STATISTICS FalseAlmCnt = &(pdmpriv->FalseAlmCnt);
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_FA_SAMPLE	pSample = NULL;
+	u32		Peak;
+#ifdef CONFIG_CONCURRENT_MODE
+	PADAPTER pbuddy_adapter = Adapter->pbuddy_adapter;
+#endif //CONFIG_CONCURRENT_MODE
+
+	if(pdmext)
+		pSample = &pdmext->FaSample;
+
+	Peak = dm_FAReadCounters(Adapter, FalseAlmCnt);
+	if(pSample)
+		dm_FASampleEnd(pSample, Peak);
+
+	FalseAlmCnt->Cnt_Ofdm_fail = 	FalseAlmCnt->Cnt_Parity_Fail + FalseAlmCnt->Cnt_Rate_Illegal +
+								FalseAlmCnt->Cnt_Crc8_fail + FalseAlmCnt->Cnt_Mcs_fail+
+								FalseAlmCnt->Cnt_Fast_Fsync + FalseAlmCnt->Cnt_SB_Search_fail;
 	
 	FalseAlmCnt->Cnt_all = (	FalseAlmCnt->Cnt_Parity_Fail +
 						FalseAlmCnt->Cnt_Rate_Illegal +
@@ -194,19 +1471,21 @@ dm_FalseAlarmCounterStatistics(
 						FalseAlmCnt->Cnt_Mcs_fail +
 						FalseAlmCnt->Cnt_Cck_fail);	
 
+	if(pSample)
+	{
+		pSample->AllPerSec = (u32)div_u64((u64)FalseAlmCnt->Cnt_all * 1000, pSample->IntervalMs);
+		pSample->OfdmPerSec = (u32)div_u64((u64)FalseAlmCnt->Cnt_Ofdm_fail * 1000, pSample->IntervalMs);
+		pSample->CckPerSec = (u32)div_u64((u64)FalseAlmCnt->Cnt_Cck_fail * 1000, pSample->IntervalMs);
+
+		// DIG thresholds are counts per nominal watchdog period.
+		FalseAlmCnt->Cnt_all = (u32)div_u64((u64)pSample->AllPerSec * DM_FA_NOMINAL_MS, 1000);
+	}
+
 	Adapter->recvpriv.FalseAlmCnt_all = FalseAlmCnt->Cnt_all;
 #ifdef CONFIG_CONCURRENT_MODE
 	if(pbuddy_adapter)
 		pbuddy_adapter->recvpriv.FalseAlmCnt_all = FalseAlmCnt->Cnt_all;
-#endif //CONFIG_CONCURRENT_MODE
-
-	//reset false alarm counter registers
-	PHY_SetBBReg(Adapter, rOFDM1_LSTF, 0x08000000, 1);
-	PHY_SetBBReg(Adapter, rOFDM1_LSTF, 0x08000000, 0);
-	//reset cck counter
-	PHY_SetBBReg(Adapter, rCCK0_FalseAlarmReport, 0x0000c000, 0);
-	//enable cck counter
-	PHY_SetBBReg(Adapter, rCCK0_FalseAlarmReport, 0x0000c000, 2);
+#endif //CONFIG_CONCURRENT_MODE
 
 	//RT_TRACE(	COMP_DIG, DBG_LOUD, ("Cnt_Parity_Fail = %ld, Cnt_Rate_Illegal = %ld, Cnt_Crc8_fail = %ld, Cnt_Mcs_fail = %ld\n", 
 	//			FalseAlmCnt->Cnt_Parity_Fail, FalseAlmCnt->Cnt_Rate_Illegal, FalseAlmCnt->Cnt_Crc8_fail, FalseAlmCnt->Cnt_Mcs_fail) );
@@ -264,6 +1543,330 @@ DM_Write_DIG(
 }
 
 
+//============================================================
+// SoftAP automatic channel selection
+//============================================================
+static void
+dm_AcsBssLoad(
+	IN	PADAPTER	Adapter,
+	IN	PDM_ACS		pAcs)
+{
+	struct mlme_priv	*pmlmepriv = &Adapter->mlmepriv;
+	struct wlan_network	*pnetwork;
+	_list	*plist, *phead;
+	_irqL	irqL;
+	int		ch, i, d;
+	long	Rssi;
+
+	_enter_critical_bh(&(pmlmepriv->scanned_queue.lock), &irqL);
+
+	phead = get_list_head(&pmlmepriv->scanned_queue);
+	plist = get_next(phead);
+	while(rtw_end_of_queue_search(phead, plist) == _FALSE)
+	{
+		pnetwork = LIST_CONTAINOR(plist, struct wlan_network, list);
+		plist = get_next(plist);
+
+		ch = pnetwork->network.Configuration.DSConfig;
+		Rssi = pnetwork->network.Rssi;
+		if((ch < 1) || (ch > DM_ACS_CH_NUM))
+			continue;
+
+		for(i = 1; i <= DM_ACS_CH_NUM; i++)
+		{
+			d = (ch > i) ? (ch - i) : (i - ch);
+			if(d > 4)
+				continue;
+
+			if(d == 0)
+			{
+				pAcs->Ch[i-1].BssCnt++;
+				if((pAcs->Ch[i-1].BssCnt == 1) || (Rssi > pAcs->Ch[i-1].MaxRssi))
+					pAcs->Ch[i-1].MaxRssi = (s8)Rssi;
+			}
+			else
+			{
+				pAcs->Ch[i-1].OverlapCnt++;
+			}
+
+			// Overlap weight (5-d)/5; weak BSSs count half.
+			pAcs->Ch[i-1].BssBusy += (DM_ACS_BSS_PERMILLE * (5 - d) / 5) >>
+				((Rssi > DM_ACS_STRONG_RSSI) ? 0 : 1);
+		}
+	}
+
+	_exit_critical_bh(&(pmlmepriv->scanned_queue.lock), &irqL);
+}
+
+//
+// Channels of the regulatory domain, BIT(ch-1).
+//
+static u16
+dm_AcsChannelMask(
+	IN	PADAPTER	Adapter)
+{
+	struct mlme_ext_priv	*pmlmeext = &Adapter->mlmeextpriv;
+	u16		Mask = 0;
+	u8		i, ch;
+
+	for(i = 0; (i < pmlmeext->max_chan_nums) && (i < MAX_CHANNEL_NUM); i++)
+	{
+		ch = pmlmeext->channel_set[i].ChannelNum;
+		if(ch == 0)
+			break;
+		if(ch <= DM_ACS_CH_NUM)
+			Mask |= BIT(ch-1);
+	}
+
+	return Mask;
+}
+
+//
+// Going off channel is only safe while no interface on the dongle
+// beacons, holds a link or scans, and the RF is on.
+//
+static BOOLEAN
+dm_AcsCanSurvey(
+	IN	PADAPTER	Adapter)
+{
+	int		State = WIFI_AP_STATE | WIFI_ADHOC_STATE | WIFI_ADHOC_MASTER_STATE |
+				_FW_LINKED | _FW_UNDER_SURVEY | _FW_UNDER_LINKING;
+
+	if((Adapter->hw_init_completed == _FALSE) ||
+		Adapter->bDriverStopped || Adapter->bSurpriseRemoved)
+		return _FALSE;
+	if(Adapter->pwrctrlpriv.rf_pwrstate != rf_on)
+		return _FALSE;
+	if(check_fwstate(&Adapter->mlmepriv, State) == _TRUE)
+		return _FALSE;
+#ifdef CONFIG_CONCURRENT_MODE
+	if(Adapter->pbuddy_adapter &&
+		(check_fwstate(&Adapter->pbuddy_adapter->mlmepriv, State) == _TRUE))
+		return _FALSE;
+#endif
+
+	return _TRUE;
+}
+
+//
+// Visit one channel for DwellMs. The channel, IGI and TXPAUSE found on
+// entry are back on return, and the false alarm period restarts.
+//
+static void
+dm_AcsVisit(
+	IN	PADAPTER	Adapter,
+	IN	PDM_ACS		pAcs,
+	IN	u8			ch)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	DIG_T	*pDigTable = &pdmpriv->DM_DigTable;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_ACS_CH	pCh = &pAcs->Ch[ch-1];
+	FALSE_ALARM_STATISTICS	Cnt;
+	u8		SavedChannel, SavedTxPause;
+	u32		Busy, Ofdm;
+
+	SavedChannel = pHalData->CurrentChannel;
+	SavedTxPause = rtw_read8(Adapter, REG_TXPAUSE);
+	rtw_write8(Adapter, REG_TXPAUSE, 0xff);
+	PHY_SetBBReg(Adapter, rOFDM0_XAAGCCore1, 0x7f, DM_ACS_IGI);
+	PHY_SetBBReg(Adapter, rOFDM0_XBAGCCore1, 0x7f, DM_ACS_IGI);
+
+	PHY_SwChnl8192C(Adapter, ch);
+	dm_FAReadCounters(Adapter, &Cnt);		// clear
+	rtw_msleep_os(pAcs->DwellMs);
+	_rtw_memset(&Cnt, 0, sizeof(Cnt));
+	dm_FAReadCounters(Adapter, &Cnt);
+
+	PHY_SwChnl8192C(Adapter, SavedChannel);
+	rtl8192c_dm_RFShadowInvalidate(Adapter);
+	PHY_SetBBReg(Adapter, rOFDM0_XAAGCCore1, 0x7f, pDigTable->CurIGValue);
+	PHY_SetBBReg(Adapter, rOFDM0_XBAGCCore1, 0x7f, pDigTable->CurIGValue);
+	rtw_write8(Adapter, REG_TXPAUSE, SavedTxPause);
+
+	pCh->FaParity = Cnt.Cnt_Parity_Fail;
+	pCh->FaRateIllegal = Cnt.Cnt_Rate_Illegal;
+	pCh->FaCrc8 = Cnt.Cnt_Crc8_fail;
+	pCh->FaMcs = Cnt.Cnt_Mcs_fail;
+	pCh->FaFastFsync = Cnt.Cnt_Fast_Fsync;
+	pCh->FaSbSearch = Cnt.Cnt_SB_Search_fail;
+	Ofdm = Cnt.Cnt_Parity_Fail + Cnt.Cnt_Rate_Illegal + Cnt.Cnt_Crc8_fail +
+		Cnt.Cnt_Mcs_fail + Cnt.Cnt_Fast_Fsync + Cnt.Cnt_SB_Search_fail;
+	pCh->OfdmFAPerSec = Ofdm * 1000 / pAcs->DwellMs;
+	pCh->CckFAPerSec = Cnt.Cnt_Cck_fail * 1000 / pAcs->DwellMs;
+
+	// us busy per second is permille of airtime x1000.
+	Busy = (pCh->OfdmFAPerSec * DM_ACS_OFDM_FA_US + pCh->CckFAPerSec * DM_ACS_CCK_FA_US) / 1000;
+	pCh->FaBusy = (Busy > 1000) ? 1000 : (u16)Busy;
+	if(pCh->BssBusy > 1000)
+		pCh->BssBusy = 1000;
+	Busy = pCh->FaBusy + pCh->BssBusy;
+	pCh->Usable = (Busy >= 1000) ? 0 : (u16)(1000 - Busy);
+
+	// Do not charge the visit to DIG.
+	dm_FAReadCounters(Adapter, &Cnt);
+	pdmext->FaSample.LastTime = rtw_get_current_time();
+}
+
+//
+// Pick the channel with the most usable airtime, fewer BSSs on a tie,
+// and report it.
+//
+static void
+dm_AcsFinish(
+	IN	PADAPTER	Adapter,
+	IN	PDM_ACS		pAcs)
+{
+	PDM_ACS_CH	pCh;
+	char	Env[32];
+	char	*Envp[] = { Env, NULL };
+	u16		Best = 0;
+	u8		BestCh = 0, ch;
+
+	for(ch = 1; ch <= DM_ACS_CH_NUM; ch++)
+	{
+		if(!(pAcs->ChannelMask & BIT(ch-1)))
+			continue;
+		pCh = &pAcs->Ch[ch-1];
+
+		if((BestCh == 0) || (pCh->Usable > Best) ||
+			((pCh->Usable == Best) && (pCh->BssCnt < pAcs->Ch[BestCh-1].BssCnt)))
+		{
+			BestCh = ch;
+			Best = pCh->Usable;
+		}
+	}
+
+	pAcs->BestChannel = BestCh;
+	pAcs->SurveyMs = rtw_get_passing_time_ms(pAcs->Start);
+	pAcs->LastSurvey = rtw_get_current_time();
+	pAcs->SurveyCnt++;
+	pAcs->bRunning = _FALSE;
+
+	DBG_8192C("%s: best channel %u, usable %u/1000, %u ms\n", __FUNCTION__,
+		BestCh, Best, pAcs->SurveyMs);
+
+	if(Adapter->pnetdev)
+	{
+		snprintf(Env, sizeof(Env), "RTW_ACS_CHANNEL=%u", BestCh);
+		kobject_uevent_env(&Adapter->pnetdev->dev.kobj, KOBJ_CHANGE, Envp);
+	}
+}
+
+//
+// Advance the survey by one channel. Called at the end of the watchdog
+// tick, after the DM and with the firmware awake.
+//
+static void
+dm_AcsStep(
+	IN	PADAPTER	Adapter)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_ACS		pAcs;
+	u16		ChannelMask;
+	u8		ch;
+
+	if(pdmext == NULL)
+		return;
+	pAcs = &pdmext->Acs;
+
+	if(pAcs->bAbort)
+	{
+		pAcs->bAbort = _FALSE;
+		pAcs->bPending = _FALSE;
+		pAcs->bRunning = _FALSE;
+	}
+
+	if(!pAcs->bRunning && !pAcs->bPending)
+	{
+		if((pAcs->PeriodSec == 0) ||
+			(rtw_get_passing_time_ms(pAcs->LastSurvey) < pAcs->PeriodSec * 1000))
+			return;
+		pAcs->bPending = _TRUE;
+	}
+
+	if(dm_AcsCanSurvey(Adapter) == _FALSE)
+	{
+		if(pAcs->bRunning)
+		{
+			pAcs->bRunning = _FALSE;
+			pAcs->bPending = _TRUE;
+			pAcs->RestartCnt++;
+		}
+		return;
+	}
+
+	if(!pAcs->bRunning)
+	{
+		pAcs->bPending = _FALSE;
+		ChannelMask = dm_AcsChannelMask(Adapter);
+		if(ChannelMask == 0)
+			return;
+
+		pAcs->ChannelMask = ChannelMask;
+		pAcs->NextCh = 1;
+		_rtw_memset(pAcs->Ch, 0, sizeof(pAcs->Ch));
+		pAcs->Start = rtw_get_current_time();
+		dm_AcsBssLoad(Adapter, pAcs);
+		pAcs->bRunning = _TRUE;
+	}
+
+	for(ch = pAcs->NextCh; ch <= DM_ACS_CH_NUM; ch++)
+	{
+		if(pAcs->ChannelMask & BIT(ch-1))
+			break;
+	}
+	if(ch <= DM_ACS_CH_NUM)
+	{
+		dm_AcsVisit(Adapter, pAcs, ch);
+		pAcs->NextCh = ch + 1;
+	}
+
+	if((ch >= DM_ACS_CH_NUM) || !(pAcs->ChannelMask >> ch))
+		dm_AcsFinish(Adapter, pAcs);
+}
+
+//
+// Survey once with DwellMs per channel (0 for the default), and then
+// every PeriodSec seconds, 0 for no repeat. The survey starts on the
+// next idle watchdog tick.
+//
+static int
+dm_AcsStart(
+	IN	PADAPTER	Adapter,
+	IN	u16			DwellMs,
+	IN	u32			PeriodSec)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if((pdmext == NULL) || (DwellMs > DM_ACS_DWELL_MS_MAX))
+		return _FAIL;
+
+	pdmext->Acs.DwellMs = DwellMs ? DwellMs : DM_ACS_DWELL_MS_DEFAULT;
+	pdmext->Acs.PeriodSec = PeriodSec;
+	pdmext->Acs.bPending = _TRUE;
+
+	return _SUCCESS;
+}
+
+//
+// Stop the periodic survey; one in progress is dropped on the next tick.
+//
+static void
+dm_AcsStop(
+	IN	PADAPTER	Adapter)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if(pdmext == NULL)
+		return;
+
+	pdmext->Acs.PeriodSec = 0;
+	pdmext->Acs.bAbort = _TRUE;
+}
+
+
 static VOID 
 dm_CtrlInitGainByFA(
 	IN	PADAPTER	pAdapter
@@ -299,139 +1902,6 @@ dm_CtrlInitGainByFA(
 	
 }
 
-#ifdef CONFIG_SPECIAL_SETTING_FOR_FUNAI_TV
-VOID dm_CtrlInitGainByRssi( IN PADAPTER pAdapter) 
-{ 
-
-	u32 isBT;
-	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(pAdapter);
-	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
-	DIG_T	*pDigTable = &pdmpriv->DM_DigTable;
-	PFALSE_ALARM_STATISTICS FalseAlmCnt = &(pdmpriv->FalseAlmCnt);	
-
-	 //modify DIG upper bound
-	if((pDigTable->Rssi_val_min + 20) > DM_DIG_MAX )
-		pDigTable->rx_gain_range_max = DM_DIG_MAX;
- 	else
-  		pDigTable->rx_gain_range_max = pDigTable->Rssi_val_min + 20;
-
-	//modify DIG lower bound	
-	if((FalseAlmCnt->Cnt_all > 500)&&(pdmpriv->DIG_Dynamic_MIN < 0x25))
-  		pdmpriv->DIG_Dynamic_MIN++;
- 	if((FalseAlmCnt->Cnt_all < 500)&&(pdmpriv->DIG_Dynamic_MIN > DM_DIG_MIN))
-  		pdmpriv->DIG_Dynamic_MIN--;
-	if((pDigTable->Rssi_val_min < 8) && (pdmpriv->DIG_Dynamic_MIN > DM_DIG_MIN))
-		pdmpriv->DIG_Dynamic_MIN--;
-	
- 	//modify DIG lower bound, deal with abnorally large false alarm
- 	if(FalseAlmCnt->Cnt_all > 10000)
- 	{
- 		//RT_TRACE(COMP_DIG, DBG_LOUD, ("dm_DIG(): Abnornally false alarm case. \n"));
-  		pDigTable->LargeFAHit++;
- 		 if(pDigTable->ForbiddenIGI < pDigTable->CurIGValue)
-  		{
-   			pDigTable->ForbiddenIGI = pDigTable->CurIGValue;
-	  		pDigTable->LargeFAHit = 1;
-	  	}
-	  	if(pDigTable->LargeFAHit >= 3)
-	  	{
-			if((pDigTable->ForbiddenIGI+1) >pDigTable->rx_gain_range_max)
-		    		pDigTable->rx_gain_range_min = pDigTable->rx_gain_range_max;
-		   	else
-		    		pDigTable->rx_gain_range_min = (pDigTable->ForbiddenIGI + 1);
-		   	pDigTable->Recover_cnt = 3600; //3600=2hr
-		  }
-	 }
-	 else
-	 {
-	  //Recovery mechanism for IGI lower bound
-	  	if(pDigTable->Recover_cnt != 0){
-	   		pDigTable->Recover_cnt --;
-	  	}
-	  	else
-	 	{
-			if(pDigTable->LargeFAHit == 0 )
-	   		{
-	   			if((pDigTable->ForbiddenIGI -1) < pdmpriv->DIG_Dynamic_MIN) //DM_DIG_MIN)
-			    	{
-			     		pDigTable->ForbiddenIGI = pdmpriv->DIG_Dynamic_MIN; //DM_DIG_MIN;
-			     		pDigTable->rx_gain_range_min = pdmpriv->DIG_Dynamic_MIN; //DM_DIG_MIN;
-			    	}
-			    	else
-			    	{
-			     		pDigTable->ForbiddenIGI --;
-			     		pDigTable->rx_gain_range_min = (pDigTable->ForbiddenIGI + 1);
-			    	}
-	   		}
-	   		else if(pDigTable->LargeFAHit == 3 )
-	   		{
-	    			pDigTable->LargeFAHit = 0;
-	   		}
-	  	}
-	 }
- #ifdef CONFIG_USB_HCI
-	if(FalseAlmCnt->Cnt_all < 250)
-	{
-#endif
-		//DBG_8192C("===> dm_CtrlInitGainByRssi, Enter DIG by SS mode\n");
-		
-		isBT = rtw_read8(pAdapter, 0x4fd) & 0x01;
-
-		if(!isBT){
-
-			if(FalseAlmCnt->Cnt_all > pDigTable->FAHighThresh)
-			{
-				if((pDigTable->BackoffVal -2) < pDigTable->BackoffVal_range_min)
-					pDigTable->BackoffVal = pDigTable->BackoffVal_range_min;
-				else
-					pDigTable->BackoffVal -= 2; 
-			}	
-			else if(FalseAlmCnt->Cnt_all < pDigTable->FALowThresh)
-			{
-				if((pDigTable->BackoffVal+2) > pDigTable->BackoffVal_range_max)
-					pDigTable->BackoffVal = pDigTable->BackoffVal_range_max;
-				else
-					pDigTable->BackoffVal +=2;
-			}	
-		}
-		else
-			pDigTable->BackoffVal = DM_DIG_BACKOFF_DEFAULT;
-
-		pDigTable->CurIGValue = pDigTable->Rssi_val_min+10-pDigTable->BackoffVal;	
-
-		//DBG_8192C("Rssi_val_min = %x BackoffVal %x\n",pDigTable->Rssi_val_min, pDigTable->BackoffVal);
-#ifdef CONFIG_USB_HCI
-	}
-	else
-	{		
-		//DBG_8192C("===> dm_CtrlInitGainByRssi, Enter DIG by FA mode\n");
-		//DBG_8192C("RSSI = 0x%x", pDigTable->Rssi_val_min);
-
-		//Adjust initial gain by false alarm		
-		if(FalseAlmCnt->Cnt_all > 1000)
-			pDigTable->CurIGValue = pDigTable ->PreIGValue+2;
-		else if (FalseAlmCnt->Cnt_all > 750)
-			pDigTable->CurIGValue = pDigTable->PreIGValue+1;
-		else if(FalseAlmCnt->Cnt_all < 500)
-			pDigTable->CurIGValue = pDigTable->PreIGValue-1;	
-	}
-#endif
-
-	//Check initial gain by upper/lower bound
-	if(pDigTable->CurIGValue >pDigTable->rx_gain_range_max)
-		pDigTable->CurIGValue = pDigTable->rx_gain_range_max;
-
-	if(pDigTable->CurIGValue < pDigTable->rx_gain_range_min)
-		pDigTable->CurIGValue = pDigTable->rx_gain_range_min;
-
-	//printk("%s => rx_gain_range_max(0x%02x) rx_gain_range_min(0x%02x)\n",__FUNCTION__,
-	//	pDigTable->rx_gain_range_max,pDigTable->rx_gain_range_min);
-	//printk("%s CurIGValue(0x%02x)  <====\n",__FUNCTION__,pDigTable->CurIGValue );		
-
-	DM_Write_DIG(pAdapter);
-
-}
-#else
 static VOID dm_CtrlInitGainByRssi(IN	PADAPTER	pAdapter)	
 {
 	u32 isBT;
@@ -439,6 +1909,8 @@ static VOID dm_CtrlInitGainByRssi(IN	PADAPTER	pAdapter)
 	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
 	DIG_T	*pDigTable = &pdmpriv->DM_DigTable;
 	PFALSE_ALARM_STATISTICS FalseAlmCnt = &(pdmpriv->FalseAlmCnt);
+	const DM_TUNING_PROFILE	*pProfile = GET_DM_PROFILE(pAdapter);
+	u8	DigMin = DM_DIG_MIN;
 
 	//modify DIG upper bound
 	if((pDigTable->Rssi_val_min + 20) > DM_DIG_MAX )
@@ -447,6 +1919,19 @@ static VOID dm_CtrlInitGainByRssi(IN	PADAPTER	pAdapter)
 		pDigTable->rx_gain_range_max = pDigTable->Rssi_val_min + 20;
 	//printk("%s Rssi_val_min(0x%02x),rx_gain_range_max(0x%02x)\n",__FUNCTION__,pDigTable->Rssi_val_min,pDigTable->rx_gain_range_max);
 
+	//modify DIG lower bound
+	if(pProfile->bDIGDynamicMin)
+	{
+		if((FalseAlmCnt->Cnt_all > pProfile->DIGDynamicMinFA)&&(pdmpriv->DIG_Dynamic_MIN < pProfile->DIGDynamicMinInit))
+			pdmpriv->DIG_Dynamic_MIN++;
+		if((FalseAlmCnt->Cnt_all < pProfile->DIGDynamicMinFA)&&(pdmpriv->DIG_Dynamic_MIN > DM_DIG_MIN))
+			pdmpriv->DIG_Dynamic_MIN--;
+		if((pDigTable->Rssi_val_min < 8) && (pdmpriv->DIG_Dynamic_MIN > DM_DIG_MIN))
+			pdmpriv->DIG_Dynamic_MIN--;
+
+		DigMin = pdmpriv->DIG_Dynamic_MIN;
+	}
+
 	//modify DIG lower bound, deal with abnorally large false alarm
 	if(FalseAlmCnt->Cnt_all > 10000)
 	{
@@ -477,10 +1962,10 @@ static VOID dm_CtrlInitGainByRssi(IN	PADAPTER	pAdapter)
 		{
 			if(pDigTable->LargeFAHit == 0 )
 			{
-				if((pDigTable->ForbiddenIGI -1) < DM_DIG_MIN)
+				if((pDigTable->ForbiddenIGI -1) < DigMin)
 				{
-					pDigTable->ForbiddenIGI = DM_DIG_MIN;
-					pDigTable->rx_gain_range_min = DM_DIG_MIN;
+					pDigTable->ForbiddenIGI = DigMin;
+					pDigTable->rx_gain_range_min = DigMin;
 				}
 				else
 				{
@@ -560,7 +2045,6 @@ static VOID dm_CtrlInitGainByRssi(IN	PADAPTER	pAdapter)
 	DM_Write_DIG(pAdapter);
 
 }
-#endif
 
 static VOID
 dm_initial_gain_Multi_STA(
@@ -570,7 +2054,8 @@ dm_initial_gain_Multi_STA(
 	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
 	struct mlme_priv	*pmlmepriv = &(pAdapter->mlmepriv);
 	DIG_T			*pDigTable = &pdmpriv->DM_DigTable;
-	int				rssi_strength =  pdmpriv->EntryMinUndecoratedSmoothedPWDB;	
+	int				rssi_strength =  dm_DIGEntryPWDB(pAdapter);	
+	int				RssiLowThresh;
 	BOOLEAN			bMulti_STA = _FALSE;
 	
 #ifdef CONFIG_CONCURRENT_MODE
@@ -612,7 +2097,10 @@ dm_initial_gain_Multi_STA(
 	// Initial gain control by ap mode 
 	if(pDigTable->CurMultiSTAConnectState == DIG_MultiSTA_CONNECT)
 	{
-		if (	(rssi_strength < pDigTable->RssiLowThresh) 	&& 
+		RssiLowThresh = pDigTable->RssiHighThresh -
+			dm_RssiMargin(pAdapter, pDigTable->RssiHighThresh - pDigTable->RssiLowThresh);
+
+		if (	(rssi_strength < RssiLowThresh) 	&& 
 			(pDigTable->Dig_Ext_Port_Stage != DIG_EXT_PORT_STAGE_1))
 		{					
 			// Set to dig value to 0x20 for Luke's opinion after disable dig
@@ -690,7 +2178,7 @@ dm_initial_gain_STA(
 		// disconnect -> connecct or beforeconnect -> connect
 		if(pDigTable->CurSTAConnectState != DIG_STA_DISCONNECT)
 		{
-			pDigTable->Rssi_val_min = dm_initial_gain_MinPWDB(pAdapter);
+			pDigTable->Rssi_val_min = dm_initial_gain_MinPWDB(pAdapter, _TRUE);
 			dm_CtrlInitGainByRssi(pAdapter);
 		}	
 #ifdef CONFIG_IOCTL_CFG80211
@@ -738,7 +2226,7 @@ static void dm_CCK_PacketDetectionThresh(
 
 	if(pDigTable->CurSTAConnectState == DIG_STA_CONNECT)
 	{
-		pDigTable->Rssi_val_min = dm_initial_gain_MinPWDB(pAdapter);
+		pDigTable->Rssi_val_min = dm_initial_gain_MinPWDB(pAdapter, _FALSE);
 		if(pDigTable->PreCCKPDState == CCK_PD_STAGE_LowRssi)
 		{
 			if(pDigTable->Rssi_val_min <= 25)
@@ -747,7 +2235,7 @@ static void dm_CCK_PacketDetectionThresh(
 				pDigTable->CurCCKPDState = CCK_PD_STAGE_HighRssi;
 		}
 		else{
-			if(pDigTable->Rssi_val_min <= 20)
+			if(pDigTable->Rssi_val_min <= (25 - dm_RssiMargin(pAdapter, 5)))
 				pDigTable->CurCCKPDState = CCK_PD_STAGE_LowRssi;
 			else
 				pDigTable->CurCCKPDState = CCK_PD_STAGE_HighRssi;
@@ -892,27 +2380,190 @@ static void dm_SavePowerIndex(IN	PADAPTER	Adapter)
 		pdmpriv->PowerIndex_backup[index] = rtw_read8(Adapter, Power_Index_REG[index]);
 }
 
-static void dm_RestorePowerIndex(IN	PADAPTER	Adapter)
-{
-	u8			index;
-	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
-	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
-	u32			Power_Index_REG[6] = {0xc90, 0xc91, 0xc92, 0xc98, 0xc99, 0xc9a};
-	
-	for(index = 0; index< 6; index++)
-		rtw_write8(Adapter, Power_Index_REG[index], pdmpriv->PowerIndex_backup[index]);
+//
+// Power index registers are two runs of 3 bytes (0xc90-0xc92, 0xc98-0xc9a),
+// write each run in one burst.
+//
+static void dm_RestorePowerIndex(IN	PADAPTER	Adapter)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	
+	rtw_writeN(Adapter, 0xc90, 3, &pdmpriv->PowerIndex_backup[0]);
+	rtw_writeN(Adapter, 0xc98, 3, &pdmpriv->PowerIndex_backup[3]);
+}
+
+static void dm_WritePowerIndex(
+		IN	PADAPTER	Adapter, 
+		IN 	u8		Value)
+{
+	u8			PowerIndex[3];
+	
+	PowerIndex[0] = PowerIndex[1] = PowerIndex[2] = Value;
+	rtw_writeN(Adapter, 0xc90, 3, PowerIndex);
+	rtw_writeN(Adapter, 0xc98, 3, PowerIndex);
+}
+
+//
+// Description:
+//		Drop all captured TX power images, e.g. after the EFUSE power
+//		tables or the registry power limits have been reloaded.
+//
+static void
+rtl8192c_dm_TxPowerImageInvalidate(
+	IN	PADAPTER	Adapter)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if(pdmext && pdmext->pTxPwrImg)
+	{
+		_rtw_memset(pdmext->pTxPwrImg->Valid, 0, sizeof(pdmext->pTxPwrImg->Valid));
+		_rtw_memset(pdmext->pTxPwrImg->Missed, 0, sizeof(pdmext->pTxPwrImg->Missed));
+	}
+}
+
+static u32 *
+dm_TxPowerImageSlot(
+	IN	PADAPTER	Adapter,
+	IN	u8			channel,
+	OUT	u8			**ppValid,
+	OUT	u8			**ppMissed,
+	OUT	u8			**ppCckIdx,
+	OUT	u8			**ppOfdmIdx,
+	OUT	u8			*pLvlBit)
+{
+	HAL_DATA_TYPE		*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv		*pdmpriv = &pHalData->dmpriv;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	u8	bw = pHalData->CurrentChannelBW;
+	u8	lvl = pdmpriv->DynamicTxHighPowerLvl;
+
+#if MP_DRIVER == 1
+	// MP tools set arbitrary power levels, never cache.
+	return NULL;
+#endif
+
+	if((pdmext == NULL) || (pdmext->pTxPwrImg == NULL))
+		return NULL;
+
+	// The scan and BT coexistence adjust the TX AGC on their own.
+	if(check_fwstate(&Adapter->mlmepriv, _FW_UNDER_SURVEY) == _TRUE)
+		return NULL;
+#ifdef CONFIG_BT_COEXIST
+	if(pHalData->bt_coexist.BT_Coexist)
+		return NULL;
+#endif
+
+	if((channel < 1) || (channel > DM_TXPWR_IMG_CH_NUM) ||
+		(bw >= DM_TXPWR_IMG_BW_NUM) || (lvl >= DM_TXPWR_IMG_LVL_NUM))
+		return NULL;
+
+	if(pdmext->pTxPwrImg->Regulatory != pHalData->EEPROMRegulatory)
+	{
+		rtl8192c_dm_TxPowerImageInvalidate(Adapter);
+		pdmext->pTxPwrImg->Regulatory = pHalData->EEPROMRegulatory;
+	}
+
+	*ppValid = &pdmext->pTxPwrImg->Valid[bw][channel-1];
+	*ppMissed = &pdmext->pTxPwrImg->Missed[bw][channel-1];
+	*ppCckIdx = &pdmext->pTxPwrImg->CckIdx[bw][channel-1][lvl];
+	*ppOfdmIdx = &pdmext->pTxPwrImg->OfdmIdx[bw][channel-1][lvl];
+	*pLvlBit = BIT(lvl);
+
+	return pdmext->pTxPwrImg->Image[bw][channel-1][lvl];
+}
+
+//
+// Description:
+//		Program the TX AGC registers for the channel from the captured
+//		image, and the power indexes PHY_SetTxPowerLevel8192C() would have
+//		left in the HAL data. Returns _FALSE if there is no image yet, and
+//		then the caller has to fall back to PHY_SetTxPowerLevel8192C() and
+//		capture the result with rtl8192c_dm_TxPowerImageCapture().
+//
+static BOOLEAN
+rtl8192c_dm_TxPowerImageApply(
+	IN	PADAPTER	Adapter,
+	IN	u8			channel)
+{
+	HAL_DATA_TYPE		*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	u8	*pValid, *pMissed, *pCckIdx, *pOfdmIdx, LvlBit;
+	u32	*pImage;
+	u8	buf[DM_TXPWR_IMG_DW_NUM * 4];
+	u8	i, j, dw = 0;
+
+	pImage = dm_TxPowerImageSlot(Adapter, channel, &pValid, &pMissed,
+		&pCckIdx, &pOfdmIdx, &LvlBit);
+	if((pImage == NULL) || !(*pValid & LvlBit))
+	{
+		if(pdmext)
+			pdmext->TxPwrImgMissCnt++;
+		return _FALSE;
+	}
+
+	for(i = 0; i < sizeof(TxPwrImgBlock)/sizeof(TxPwrImgBlock[0]); i++)
+	{
+		for(j = 0; j < TxPwrImgBlock[i].DwNum; j++, dw++)
+			put_unaligned_le32(pImage[dw], &buf[j*4]);
+		rtw_writeN(Adapter, TxPwrImgBlock[i].RegAddr, TxPwrImgBlock[i].DwNum * 4, buf);
+	}
+
+	pHalData->CurrentCckTxPwrIdx = *pCckIdx;
+	pHalData->CurrentOfdm24GTxPwrIdx = *pOfdmIdx;
+
+	pdmext->TxPwrImgHitCnt++;
+	return _TRUE;
 }
 
-static void dm_WritePowerIndex(
-		IN	PADAPTER	Adapter, 
-		IN 	u8		Value)
+//
+// Description:
+//		Read back the TX AGC registers just programmed by
+//		PHY_SetTxPowerLevel8192C() and keep them as the image of the
+//		current channel, bandwidth and dynamic power level. The first
+//		miss of a setting is only noted, the second one captures.
+//
+static void
+rtl8192c_dm_TxPowerImageCapture(
+	IN	PADAPTER	Adapter,
+	IN	u8			channel)
 {
-	u8			index;
-	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
-	u32			Power_Index_REG[6] = {0xc90, 0xc91, 0xc92, 0xc98, 0xc99, 0xc9a};
-	
-	for(index = 0; index< 6; index++)
-		rtw_write8(Adapter, Power_Index_REG[index], Value);
+	HAL_DATA_TYPE		*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	u8	*pValid, *pMissed, *pCckIdx, *pOfdmIdx, LvlBit;
+	u32	*pImage;
+	u8	i, j, dw = 0;
+
+	if(pdmext == NULL)
+		return;
+
+	if(pdmext->pTxPwrImg == NULL)
+	{
+		pdmext->pTxPwrImg = (PDM_TXPWR_IMG_CACHE)rtw_zvmalloc(sizeof(DM_TXPWR_IMG_CACHE));
+		if(pdmext->pTxPwrImg == NULL)
+			return;
+	}
+
+	pImage = dm_TxPowerImageSlot(Adapter, channel, &pValid, &pMissed,
+		&pCckIdx, &pOfdmIdx, &LvlBit);
+	if(pImage == NULL)
+		return;
+
+	if(!(*pMissed & LvlBit))
+	{
+		*pMissed |= LvlBit;
+		return;
+	}
+
+	for(i = 0; i < sizeof(TxPwrImgBlock)/sizeof(TxPwrImgBlock[0]); i++)
+	{
+		for(j = 0; j < TxPwrImgBlock[i].DwNum; j++, dw++)
+			pImage[dw] = rtw_read32(Adapter, TxPwrImgBlock[i].RegAddr + j*4);
+	}
+	*pCckIdx = pHalData->CurrentCckTxPwrIdx;
+	*pOfdmIdx = pHalData->CurrentOfdm24GTxPwrIdx;
+
+	*pValid |= LvlBit;
 }
 
 static void dm_InitDynamicTxPower(IN	PADAPTER	Adapter)
@@ -1038,13 +2689,13 @@ static void dm_DynamicTxPower(IN	PADAPTER	Adapter)
 		pdmpriv->DynamicTxHighPowerLvl = TxHighPwrLevel_Level2;
 		//RT_TRACE(COMP_HIPWR, DBG_LOUD, ("TxHighPwrLevel_Level1 (TxPwr=0x0)\n"));
 	}
-	else if((UndecoratedSmoothedPWDB < (TX_POWER_NEAR_FIELD_THRESH_LVL2-3)) &&
+	else if((UndecoratedSmoothedPWDB < (TX_POWER_NEAR_FIELD_THRESH_LVL2-dm_RssiMargin(Adapter, 3))) &&
 		(UndecoratedSmoothedPWDB >= TX_POWER_NEAR_FIELD_THRESH_LVL1) )
 	{
 		pdmpriv->DynamicTxHighPowerLvl = TxHighPwrLevel_Level1;
 		//RT_TRACE(COMP_HIPWR, DBG_LOUD, ("TxHighPwrLevel_Level1 (TxPwr=0x10)\n"));
 	}
-	else if(UndecoratedSmoothedPWDB < (TX_POWER_NEAR_FIELD_THRESH_LVL1-5))
+	else if(UndecoratedSmoothedPWDB < (TX_POWER_NEAR_FIELD_THRESH_LVL1-dm_RssiMargin(Adapter, 5)))
 	{
 		pdmpriv->DynamicTxHighPowerLvl = TxHighPwrLevel_Normal;
 		//RT_TRACE(COMP_HIPWR, DBG_LOUD, ("TxHighPwrLevel_Normal\n"));
@@ -1052,7 +2703,11 @@ static void dm_DynamicTxPower(IN	PADAPTER	Adapter)
 }
 	if( (pdmpriv->DynamicTxHighPowerLvl != pdmpriv->LastDTPLvl) )
 	{
-		PHY_SetTxPowerLevel8192C(Adapter, pHalData->CurrentChannel);
+		if(!rtl8192c_dm_TxPowerImageApply(Adapter, pHalData->CurrentChannel))
+		{
+			PHY_SetTxPowerLevel8192C(Adapter, pHalData->CurrentChannel);
+			rtl8192c_dm_TxPowerImageCapture(Adapter, pHalData->CurrentChannel);
+		}
 		if(pdmpriv->DynamicTxHighPowerLvl == TxHighPwrLevel_Normal) // HP1 -> Normal  or HP2 -> Normal
 			dm_RestorePowerIndex(Adapter);
 		else if(pdmpriv->DynamicTxHighPowerLvl == TxHighPwrLevel_Level1)
@@ -1123,8 +2778,13 @@ static VOID PWDB_Monitor(
 	u8 	sta_cnt=0;
 	u32 PWDB_rssi[NUM_STA]={0};//[0~15]:MACID, [16~31]:PWDB_rssi
 
+	dm_RssiEstBegin(Adapter);
+
 	if(check_fwstate(&Adapter->mlmepriv, _FW_LINKED) != _TRUE)
+	{
+		dm_RssiEstEnd(Adapter);
 		return;
+	}
 
 
 	if(check_fwstate(&Adapter->mlmepriv, WIFI_AP_STATE|WIFI_ADHOC_STATE|WIFI_ADHOC_MASTER_STATE) == _TRUE)
@@ -1135,6 +2795,8 @@ static VOID PWDB_Monitor(
 		struct sta_priv *pstapriv = &Adapter->stapriv;
 		u8 bcast_addr[ETH_ALEN]= {0xff,0xff,0xff,0xff,0xff,0xff};
 	
+		dm_DIGWeightBegin(Adapter);
+
 		_enter_critical_bh(&pstapriv->sta_hash_lock, &irqL);
 
 		for(i=0; i< NUM_STA; i++)
@@ -1162,6 +2824,12 @@ static VOID PWDB_Monitor(
 						tmpEntryMaxPWDB = psta->rssi_stat.UndecoratedSmoothedPWDB;
 
 					PWDB_rssi[sta_cnt++] = (psta->mac_id | (psta->rssi_stat.UndecoratedSmoothedPWDB<<16));
+
+					dm_DIGWeightAddSta(Adapter, psta->mac_id,
+						psta->rssi_stat.UndecoratedSmoothedPWDB,
+						psta->sta_stats.rx_bytes + psta->sta_stats.tx_bytes);
+					dm_RssiEstAddSta(Adapter, psta->mac_id,
+						psta->rssi_stat.UndecoratedSmoothedPWDB);
 				}
 			
 			}
@@ -1170,7 +2838,7 @@ static VOID PWDB_Monitor(
 	
 		_exit_critical_bh(&pstapriv->sta_hash_lock, &irqL);
 
-
+		dm_DIGWeightEnd(Adapter);
 		
 		if(pHalData->fw_ractrl == _TRUE)
 		{
@@ -1206,6 +2874,7 @@ static VOID PWDB_Monitor(
 
 	if(check_fwstate(&Adapter->mlmepriv, WIFI_STATION_STATE) == _TRUE)
 	{
+		dm_RssiEstAddSta(Adapter, 0, pdmpriv->UndecoratedSmoothedPWDB);
 	
 		if(pHalData->fw_ractrl == _TRUE)
 		{
@@ -1217,6 +2886,7 @@ static VOID PWDB_Monitor(
 		}
 	}
 
+	dm_RssiEstEnd(Adapter);
 }
 
 
@@ -1226,12 +2896,119 @@ DM_InitEdcaTurbo(
 	)
 {
 	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
 
 	pHalData->bCurrentTurboEDCA = _FALSE;
 	Adapter->recvpriv.bIsAnyNonBEPkts = _FALSE;
 
+	if(pdmext)
+	{
+		pdmext->EdcaAP.bActive = _FALSE;
+		pdmext->EdcaAP.bOn = _FALSE;
+	}
+}
+
+//
+// SoftAP turbo decision for the next interval, from the bytes moved in
+// the last one.
+//
+static void
+dm_CheckEdcaTurboAP(
+	IN	PADAPTER	Adapter,
+	IN	u64			cur_tx_bytes,
+	IN	u64			cur_rx_bytes,
+	IN	BOOLEAN		bNonBEExceed)
+{
+	HAL_DATA_TYPE		*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv		*pdmpriv = &pHalData->dmpriv;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_EDCA_AP_TURBO	pAP;
+	u64		Bytes = cur_tx_bytes + cur_rx_bytes;
+	BOOLEAN	bOn;
+	u8		Dir;
+
+	if(pdmext == NULL)
+		return;
+	pAP = &pdmext->EdcaAP;
+	pAP->bActive = _TRUE;
+
+	if(Bytes < DM_EDCA_AP_MIN_BYTES)
+		Dir = DM_EDCA_AP_IDLE;
+	else if(cur_tx_bytes > (cur_rx_bytes << 2))
+		Dir = DM_EDCA_AP_DOWNLINK;
+	else if(cur_rx_bytes > (cur_tx_bytes << 2))
+		Dir = DM_EDCA_AP_UPLINK;
+	else
+		Dir = DM_EDCA_AP_BALANCED;
+	pAP->DirTicks[Dir]++;
+
+	// Bytes moved in the last interval, under the parameters it ran with.
+	if(Dir == pAP->Dir)
+	{
+		if(pAP->bOn)
+		{
+			pAP->OnBytes[Dir] += Bytes;
+			pAP->OnTicks[Dir]++;
+		}
+		else
+		{
+			pAP->OffBytes[Dir] += Bytes;
+			pAP->OffTicks[Dir]++;
+		}
+	}
+
+	bOn = ((Dir == DM_EDCA_AP_UPLINK) || (Dir == DM_EDCA_AP_DOWNLINK)) && !bNonBEExceed;
+	if(bOn && (++pAP->ProbeTick >= DM_EDCA_AP_PROBE_TICKS))
+	{
+		pAP->ProbeTick = 0;
+		bOn = _FALSE;
+	}
+
+	if(bOn)
+	{
+		if((pdmpriv->prv_traffic_idx != ((Dir == DM_EDCA_AP_DOWNLINK) ? DOWN_LINK : UP_LINK)) ||
+			!pHalData->bCurrentTurboEDCA)
+		{
+			rtw_write32(Adapter, REG_EDCA_BE_PARAM,
+				(Dir == DM_EDCA_AP_DOWNLINK) ? DM_EDCA_AP_BE_DL : DM_EDCA_AP_BE_UL);
+			pdmpriv->prv_traffic_idx = (Dir == DM_EDCA_AP_DOWNLINK) ? DOWN_LINK : UP_LINK;
+		}
+		pHalData->bCurrentTurboEDCA = _TRUE;
+	}
+	else if(pHalData->bCurrentTurboEDCA)
+	{
+		rtw_write32(Adapter, REG_EDCA_BE_PARAM, pHalData->AcParam_BE);
+		pHalData->bCurrentTurboEDCA = _FALSE;
+	}
+
+	pAP->Dir = Dir;
+	pAP->bOn = bOn;
 }
 
+//
+// Change of the mean bytes per interval (offered load) with the AP turbo
+// on against off for a traffic direction, in percent.
+//
+static int
+dm_EdcaAPLoadDelta(
+	IN	PDM_EDCA_AP_TURBO	pAP,
+	IN	u8					Dir)
+{
+	u64	On, Off;
+
+	if((pAP->OnTicks[Dir] == 0) || (pAP->OffTicks[Dir] == 0))
+		return 0;
+
+	On = div_u64(pAP->OnBytes[Dir], pAP->OnTicks[Dir]);
+	Off = div_u64(pAP->OffBytes[Dir], pAP->OffTicks[Dir]);
+	if(Off == 0)
+		return 0;
+
+	if(On >= Off)
+		return (int)div64_u64((On - Off) * 100, Off);
+
+	return -(int)div64_u64((Off - On) * 100, Off);
+}
 
 static void
 dm_CheckEdcaTurbo(
@@ -1255,7 +3032,22 @@ dm_CheckEdcaTurbo(
 #endif
 
 
-	if ((pregpriv->wifi_spec == 1) || (pmlmeinfo->HT_enable == 0))
+	if (pregpriv->wifi_spec == 1)
+	{
+		goto dm_CheckEdcaTurbo_EXIT;
+	}
+
+	// assoc_AP_vendor is only meaningful as a client.
+	if (check_fwstate(&Adapter->mlmepriv, WIFI_AP_STATE) == _TRUE)
+	{
+		dm_CheckEdcaTurboAP(Adapter,
+			pxmitpriv->tx_bytes - pxmitpriv->last_tx_bytes,
+			precvpriv->rx_bytes - precvpriv->last_rx_bytes,
+			precvpriv->bIsAnyNonBEPkts);
+		goto dm_CheckEdcaTurbo_EXIT;
+	}
+
+	if (pmlmeinfo->HT_enable == 0)
 	{
 		goto dm_CheckEdcaTurbo_EXIT;
 	}
@@ -1421,7 +3213,8 @@ dm_TXPowerTrackingCallback_ThermalMeter_92C(
 
 	//DBG_8192C("===>dm_TXPowerTrackingCallback_ThermalMeter_92C\n");
 
-	ThermalValue = (u8)PHY_QueryRFReg(Adapter, RF_PATH_A, RF_T_METER, 0x1f);	// 0x24: RF Reg[4:0]	
+	// 0x24: RF Reg[4:0], the meter is re-armed for the next cycle right away
+	ThermalValue = (u8)dm_RFShadowReadTrigger(Adapter, RF_PATH_A, RF_T_METER, 0x1f, 0x60);
 
 	//DBG_8192C("\n\nReadback Thermal Meter = 0x%x pre thermal meter 0x%x EEPROMthermalmeter 0x%x\n",ThermalValue,pdmpriv->ThermalValue,  pHalData->EEPROMThermalMeter);
 
@@ -1551,6 +3344,7 @@ dm_TXPowerTrackingCallback_ThermalMeter_92C(
 		{
 			pdmpriv->ThermalValue_LCK = ThermalValue;
 			rtl8192c_PHY_LCCalibrate(Adapter);
+			rtl8192c_dm_RFShadowInvalidate(Adapter);
 		}
 		
 		if((delta > 0 || delta_HP > 0) && pdmpriv->TxPowerTrackControl)
@@ -1833,6 +3627,7 @@ dm_TXPowerTrackingCallback_ThermalMeter_92C(
 		{
 			pdmpriv->ThermalValue_IQK = ThermalValue;
 			rtl8192c_PHY_IQCalibrate(Adapter,_FALSE);
+			rtl8192c_dm_RFShadowInvalidate(Adapter);
 		}
 
 		//update thermal meter value
@@ -1910,7 +3705,7 @@ dm_CheckTXPowerTracking_ThermalMeter(
 	if(!pdmpriv->TM_Trigger)		//at least delay 1 sec
 	{
 		//pHalData->TxPowerCheckCnt++;	//cosa add for debug
-		PHY_SetRFReg(Adapter, RF_PATH_A, RF_T_METER, bRFRegOffsetMask, 0x60);
+		dm_RFShadowSetRFReg(Adapter, RF_PATH_A, RF_T_METER, bRFRegOffsetMask, 0x60, _TRUE);
 		//DBG_8192C("Trigger 92C Thermal Meter!!\n");
 		
 		pdmpriv->TM_Trigger = 1;
@@ -2530,14 +4325,14 @@ static void dm_BTCoexist(PADAPTER Adapter )
 					if(pbtpriv->BT_Service!=BT_Idle)
 					{
 						DBG_8192C("BT Set RfReg0x1E[7:4] = 0x%x \n", 0xf);
-						PHY_SetRFReg(Adapter, PathA, 0x1e, 0xf0, 0xf);
+						dm_RFShadowSetRFReg(Adapter, PathA, 0x1e, 0xf0, 0xf, _FALSE);
 						//RTPRINT(FBT, BT_TRACE, ("BT Set RfReg0x1E[7:4] = 0x%x \n", 0xf));
 						//PHY_SetRFReg(Adapter, PathA, 0x1f, 0xf0, 0xf);
 					}
 					else
 					{
 						DBG_8192C("BT Set RfReg0x1E[7:4] = 0x%x \n",pbtpriv->BtRfRegOrigin1E);
-						PHY_SetRFReg(Adapter, PathA, 0x1e, 0xf0, pbtpriv->BtRfRegOrigin1E);
+						dm_RFShadowSetRFReg(Adapter, PathA, 0x1e, 0xf0, pbtpriv->BtRfRegOrigin1E, _FALSE);
 						//RTPRINT(FBT, BT_TRACE, ("BT Set RfReg0x1F[7:4] = 0x%x \n", pHalData->bt_coexist.BtRfRegOrigin1F));
 						//PHY_SetRFReg(Adapter, PathA, 0x1f, 0xf0, pHalData->bt_coexist.BtRfRegOrigin1F);
 					}	
@@ -2561,7 +4356,7 @@ static void dm_BTCoexist(PADAPTER Adapter )
 				rtw_write8(Adapter, REG_GPIO_MUXCFG, 0x00);
 
 				DBG_8192C("BT Set RfReg0x1E[7:4] = 0x%x \n", pbtpriv->BtRfRegOrigin1E);
-				PHY_SetRFReg(Adapter, PathA, 0x1e, 0xf0, pbtpriv->BtRfRegOrigin1E);
+				dm_RFShadowSetRFReg(Adapter, PathA, 0x1e, 0xf0, pbtpriv->BtRfRegOrigin1E, _FALSE);
 				//RTPRINT(FBT, BT_TRACE, ("BT Set RfReg0x1F[7:4] = 0x%x \n", pHalData->bt_coexist.BtRfRegOrigin1F));
 				//PHY_SetRFReg(Adapter, PathA, 0x1f, 0xf0, pHalData->bt_coexist.BtRfRegOrigin1F);
 
@@ -2609,8 +4404,8 @@ static void dm_InitBtCoexistDM(	PADAPTER	Adapter)
 
 	if( !pbtpriv->BT_Coexist ) return;
 	
-	pbtpriv->BtRfRegOrigin1E = (u8)PHY_QueryRFReg(Adapter, PathA, 0x1e, 0xf0);
-	pbtpriv->BtRfRegOrigin1F = (u8)PHY_QueryRFReg(Adapter, PathA, 0x1f, 0xf0);
+	pbtpriv->BtRfRegOrigin1E = (u8)dm_RFShadowQueryRFReg(Adapter, PathA, 0x1e, 0xf0);
+	pbtpriv->BtRfRegOrigin1F = (u8)dm_RFShadowQueryRFReg(Adapter, PathA, 0x1f, 0xf0);
 }
 
 void rtl8192c_set_dm_bt_coexist(_adapter *padapter, u8 bStart)
@@ -3308,10 +5103,459 @@ dm_RefreshRateAdaptiveMask(	IN	PADAPTER	pAdapter)
 					pEntryRA->PreRATRState = pEntryRA->RATRState;
 				}
 
-			}
+			}
+		}
+	}
+#endif	
+}
+
+//============================================================
+// Dynamic A-MPDU limits
+//============================================================
+
+// Per level nibble cap of REG_AGGLEN_LMT and floor of the MPDU density.
+static const u8 AmpduLevelAggLen[DM_AMPDU_LEVEL_NUM] = {0xf, 0x8, 0x4};
+static const u8 AmpduLevelMinSpace[DM_AMPDU_LEVEL_NUM] = {0, 0, 4};	// 4: 2us
+
+static void
+dm_InitAmpduCtrl(
+	IN	PADAPTER	Adapter)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if(pdmext == NULL)
+		return;
+
+	// The HAL rewrites both registers on init, take them again.
+	pdmext->Ampdu.bBaseValid = _FALSE;
+	pdmext->Ampdu.Level = DM_AMPDU_LEVEL_LARGE;
+	pdmext->Ampdu.CleanTicks = 0;
+}
+
+static u32
+dm_AmpduCapAggLen(
+	IN	u32		AggLen,
+	IN	u8		Cap)
+{
+	u32	Capped = 0;
+	u8	i, Nibble;
+
+	for(i = 0; i < 8; i++)
+	{
+		Nibble = (u8)((AggLen >> (i * 4)) & 0xf);
+		if(Nibble > Cap)
+			Nibble = Cap;
+		Capped |= ((u32)Nibble) << (i * 4);
+	}
+
+	return Capped;
+}
+
+static void
+dm_DynamicAmpdu(
+	IN	PADAPTER	Adapter)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	struct mlme_priv	*pmlmepriv = &Adapter->mlmepriv;
+	PFALSE_ALARM_STATISTICS	FalseAlmCnt = &(pdmpriv->FalseAlmCnt);
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_AMPDU_CTRL		pAmpdu;
+	u32	AggLen;
+	u8	MinSpace, Target;
+	int	Pwdb;
+
+	if(pdmext == NULL)
+		return;
+	pAmpdu = &pdmext->Ampdu;
+
+	if(check_fwstate(pmlmepriv, _FW_LINKED) != _TRUE)
+	{
+		// Leave the HAL values behind so the next association starts clean.
+		if(pAmpdu->bBaseValid && (pAmpdu->Level != DM_AMPDU_LEVEL_LARGE))
+		{
+			if(pAmpdu->CurAggLen != pAmpdu->BaseAggLen)
+				rtw_write32(Adapter, REG_AGGLEN_LMT, pAmpdu->BaseAggLen);
+			if(pAmpdu->CurMinSpace != pAmpdu->BaseMinSpace)
+				rtw_write8(Adapter, REG_AMPDU_MIN_SPACE, pAmpdu->MinSpaceHigh | pAmpdu->BaseMinSpace);
+		}
+		pAmpdu->bBaseValid = _FALSE;
+		pAmpdu->Level = DM_AMPDU_LEVEL_LARGE;
+		return;
+	}
+
+	// New association: the HAL negotiated again, that is the new bound.
+	if((!pAmpdu->bBaseValid) ||
+		!_rtw_memcmp(pAmpdu->Bssid, get_bssid(pmlmepriv), ETH_ALEN))
+	{
+		MinSpace = rtw_read8(Adapter, REG_AMPDU_MIN_SPACE);
+		pAmpdu->BaseAggLen = pAmpdu->CurAggLen = rtw_read32(Adapter, REG_AGGLEN_LMT);
+		pAmpdu->BaseMinSpace = pAmpdu->CurMinSpace = MinSpace & 0x07;
+		pAmpdu->MinSpaceHigh = MinSpace & 0xf8;
+		_rtw_memcpy(pAmpdu->Bssid, get_bssid(pmlmepriv), ETH_ALEN);
+		pAmpdu->Level = DM_AMPDU_LEVEL_LARGE;
+		pAmpdu->CleanTicks = 0;
+		pAmpdu->bBaseValid = _TRUE;
+	}
+
+	if(check_fwstate(pmlmepriv, WIFI_AP_STATE|WIFI_ADHOC_STATE|WIFI_ADHOC_MASTER_STATE))
+		Pwdb = pdmpriv->EntryMinUndecoratedSmoothedPWDB;
+	else
+		Pwdb = pdmpriv->UndecoratedSmoothedPWDB;
+
+	if((Pwdb < 25) || (FalseAlmCnt->Cnt_all > 5000))
+		Target = DM_AMPDU_LEVEL_SMALL;
+	else if((Pwdb < 45) || (FalseAlmCnt->Cnt_all > 1000))
+		Target = DM_AMPDU_LEVEL_MID;
+	else
+		Target = DM_AMPDU_LEVEL_LARGE;
+
+	// Shrink at once, grow one level after a few clean ticks.
+	if(Target > pAmpdu->Level)
+	{
+		pAmpdu->CleanTicks = 0;
+	}
+	else if(Target < pAmpdu->Level)
+	{
+		if(++pAmpdu->CleanTicks < DM_AMPDU_UPGRADE_TICKS)
+			Target = pAmpdu->Level;
+		else
+		{
+			Target = pAmpdu->Level - 1;
+			pAmpdu->CleanTicks = 0;
+		}
+	}
+	else
+	{
+		pAmpdu->CleanTicks = 0;
+	}
+
+	if(Target != pAmpdu->Level)
+	{
+		pAmpdu->Level = Target;
+		pAmpdu->LevelChangeCnt++;
+	}
+	pAmpdu->LevelTicks[pAmpdu->Level]++;
+
+	AggLen = dm_AmpduCapAggLen(pAmpdu->BaseAggLen, AmpduLevelAggLen[pAmpdu->Level]);
+	MinSpace = pAmpdu->BaseMinSpace;
+	if(MinSpace < AmpduLevelMinSpace[pAmpdu->Level])
+		MinSpace = AmpduLevelMinSpace[pAmpdu->Level];
+
+	if(AggLen != pAmpdu->CurAggLen)
+	{
+		rtw_write32(Adapter, REG_AGGLEN_LMT, AggLen);
+		pAmpdu->CurAggLen = AggLen;
+	}
+	if(MinSpace != pAmpdu->CurMinSpace)
+	{
+		rtw_write8(Adapter, REG_AMPDU_MIN_SPACE, pAmpdu->MinSpaceHigh | MinSpace);
+		pAmpdu->CurMinSpace = MinSpace;
+	}
+}
+
+//============================================================
+// Link degradation predictor
+//============================================================
+
+static u8
+dm_LinkRiskScore(
+	IN	PADAPTER			Adapter,
+	IN	PDM_LINK_PREDICT	pPredict)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	PFALSE_ALARM_STATISTICS FalseAlmCnt = &(pdmpriv->FalseAlmCnt);
+	int	Pwdb = pdmpriv->UndecoratedSmoothedPWDB;
+	int	Slope10 = 0;		// PWDB change per tick, x10
+	u8	Score = 0, i;
+
+	// Least squares slope over the history, x = -2 .. 2.
+	if(pPredict->PwdbCnt >= DM_LINK_PWDB_HISTORY)
+	{
+		for(i = 0; i < DM_LINK_PWDB_HISTORY; i++)
+			Slope10 += ((int)i - (DM_LINK_PWDB_HISTORY / 2)) * pPredict->PwdbHist[i];
+	}
+
+	if(Pwdb < 20)
+		Score += 40;
+	else if(Pwdb < 30)
+		Score += 20;
+
+	if(Slope10 <= -20)
+		Score += 30;
+	else if(Slope10 <= -10)
+		Score += 15;
+
+	if(FalseAlmCnt->Cnt_all > 5000)
+		Score += 15;
+	else if(FalseAlmCnt->Cnt_all > 2000)
+		Score += 5;
+
+	return Score;
+}
+
+static void
+dm_LinkPredict(
+	IN	PADAPTER	Adapter)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	struct mlme_priv	*pmlmepriv = &Adapter->mlmepriv;
+	struct mlme_ext_priv	*pmlmeext = &Adapter->mlmeextpriv;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_LINK_PREDICT	pPredict;
+	BOOLEAN	bLinked;
+	u32	LeadMs;
+	u8	i;
+
+	if(pdmext == NULL)
+		return;
+	pPredict = &pdmext->LinkPredict;
+
+	bLinked = (check_fwstate(pmlmepriv, _FW_LINKED) == _TRUE) &&
+		(check_fwstate(pmlmepriv, WIFI_STATION_STATE) == _TRUE);
+
+	if(!bLinked)
+	{
+		// Link dropped: match it against the pending event.
+		if(pPredict->bWasLinked && (pPredict->MissTicks == 0))
+		{
+			pPredict->OtherEndCnt++;
+		}
+		else if(pPredict->bWasLinked)
+		{
+			pPredict->DropCnt++;
+			if(pPredict->bEventPending)
+			{
+				LeadMs = rtw_get_passing_time_ms(pPredict->EventTime);
+				pPredict->PredictedDropCnt++;
+				pPredict->LastLeadMs = LeadMs;
+				pPredict->SumLeadMs += LeadMs;
+				if((pPredict->MinLeadMs == 0) || (LeadMs < pPredict->MinLeadMs))
+					pPredict->MinLeadMs = LeadMs;
+				if(LeadMs > pPredict->MaxLeadMs)
+					pPredict->MaxLeadMs = LeadMs;
+			}
+		}
+		pPredict->bWasLinked = _FALSE;
+		pPredict->MissTicks = 0;
+		pPredict->bEventPending = _FALSE;
+		pPredict->PwdbCnt = 0;
+		pPredict->HighTicks = 0;
+		pPredict->Score = 0;
+		return;
+	}
+	pPredict->bWasLinked = _TRUE;
+
+	// The MLME link check counts its consecutive checks without a frame
+	// from the AP; the value of the last linked tick decides the cause.
+	if(pmlmeext->retry == 0)
+		pPredict->MissTicks = 0;
+	else if(pPredict->MissTicks < 0xff)
+		pPredict->MissTicks++;
+
+	if(pPredict->bEventPending &&
+		(rtw_get_passing_time_ms(pPredict->EventTime) > DM_LINK_EVENT_TIMEOUT_MS))
+	{
+		pPredict->FalseAlarmCnt++;
+		pPredict->bEventPending = _FALSE;
+	}
+
+	// Shift the PWDB history, newest last.
+	if(pPredict->PwdbCnt < DM_LINK_PWDB_HISTORY)
+		pPredict->PwdbCnt++;
+	for(i = 1; i < DM_LINK_PWDB_HISTORY; i++)
+		pPredict->PwdbHist[i-1] = pPredict->PwdbHist[i];
+	pPredict->PwdbHist[DM_LINK_PWDB_HISTORY-1] = (u8)pdmpriv->UndecoratedSmoothedPWDB;
+
+	pPredict->Score = dm_LinkRiskScore(Adapter, pPredict);
+
+	if(pPredict->Score < DM_LINK_RISK_LEAVE)
+	{
+		pPredict->HighTicks = 0;
+		return;
+	}
+	if(pPredict->Score < DM_LINK_RISK_ENTER)
+		return;
+
+	// One event per excursion above the enter level.
+	if(pPredict->HighTicks <= DM_LINK_RISK_HOLD_TICKS)
+		pPredict->HighTicks++;
+	if(pPredict->HighTicks != DM_LINK_RISK_HOLD_TICKS || pPredict->bEventPending)
+		return;
+
+	pPredict->bEventPending = _TRUE;
+	pPredict->EventTime = rtw_get_current_time();
+	pPredict->EventCnt++;
+	DBG_8192C("%s: link degrading, score %u, pwdb %d\n", __FUNCTION__,
+		pPredict->Score, pdmpriv->UndecoratedSmoothedPWDB);
+}
+
+//============================================================
+// Shadow policies
+//============================================================
+
+//
+// IGI driven by the false alarm count alone, within the gain range the
+// active DIG computed this tick.
+//
+static BOOLEAN
+dm_ShadowDIGByFA(
+	IN	PADAPTER		Adapter,
+	IN	PDM_SHADOW_STAT	pStat,
+	OUT	u32				*pShadow,
+	OUT	u32				*pActive)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	DIG_T	*pDigTable = &pdmpriv->DM_DigTable;
+	PFALSE_ALARM_STATISTICS FalseAlmCnt = &(pdmpriv->FalseAlmCnt);
+	int	value_IGI;
+
+	if((pdmpriv->bDMInitialGainEnable == _FALSE) || !(pdmpriv->DMFlag & DYNAMIC_FUNC_DIG))
+		return _FALSE;
+
+	value_IGI = (pStat->State) ? (int)pStat->State : pDigTable->CurIGValue;
+
+	if(FalseAlmCnt->Cnt_all < DM_DIG_FA_TH0)
+		value_IGI--;
+	else if(FalseAlmCnt->Cnt_all < DM_DIG_FA_TH1)
+		value_IGI += 0;
+	else if(FalseAlmCnt->Cnt_all < DM_DIG_FA_TH2)
+		value_IGI++;
+	else
+		value_IGI += 2;
+
+	if(value_IGI > pDigTable->rx_gain_range_max)
+		value_IGI = pDigTable->rx_gain_range_max;
+	if(value_IGI < pDigTable->rx_gain_range_min)
+		value_IGI = pDigTable->rx_gain_range_min;
+
+	pStat->State = (u32)value_IGI;
+	*pShadow = (u32)value_IGI;
+	*pActive = pDigTable->CurIGValue;
+	return _TRUE;
+}
+
+//
+// Dynamic TX power with the near field thresholds 5dB lower.
+//
+static BOOLEAN
+dm_ShadowTxPwrEarly(
+	IN	PADAPTER		Adapter,
+	IN	PDM_SHADOW_STAT	pStat,
+	OUT	u32				*pShadow,
+	OUT	u32				*pActive)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	struct mlme_priv	*pmlmepriv = &(Adapter->mlmepriv);
+	int	Pwdb, Lvl2 = TX_POWER_NEAR_FIELD_THRESH_LVL2 - 5, Lvl1 = TX_POWER_NEAR_FIELD_THRESH_LVL1 - 5;
+	u32	Lvl = pStat->State;
+
+	if(!pdmpriv->bDynamicTxPowerEnable || !(pdmpriv->DMFlag & DYNAMIC_FUNC_HP))
+		return _FALSE;
+
+	if((check_fwstate(pmlmepriv, _FW_LINKED) == _TRUE) &&
+		(check_fwstate(pmlmepriv, WIFI_ADHOC_MASTER_STATE|WIFI_ADHOC_STATE) != _TRUE))
+		Pwdb = pdmpriv->UndecoratedSmoothedPWDB;
+	else
+		Pwdb = pdmpriv->EntryMinUndecoratedSmoothedPWDB;
+
+	if(Pwdb == 0)
+		Lvl = TxHighPwrLevel_Normal;
+	else if(Pwdb >= Lvl2)
+		Lvl = TxHighPwrLevel_Level2;
+	else if((Pwdb < (Lvl2 - 3)) && (Pwdb >= Lvl1))
+		Lvl = TxHighPwrLevel_Level1;
+	else if(Pwdb < (Lvl1 - 5))
+		Lvl = TxHighPwrLevel_Normal;
+
+	pStat->State = Lvl;
+	*pShadow = Lvl;
+	*pActive = pdmpriv->DynamicTxHighPowerLvl;
+	return _TRUE;
+}
+
+typedef BOOLEAN (*DM_SHADOW_EVAL)(PADAPTER, PDM_SHADOW_STAT, u32 *, u32 *);
+
+static const struct
+{
+	const char		*Name;
+	DM_SHADOW_EVAL	Evaluate;
+} DMShadowTable[DM_SHADOW_NUM] =
+{
+	{"dig_fa",			dm_ShadowDIGByFA},
+	{"txpwr_early",		dm_ShadowTxPwrEarly},
+};
+
+//
+// Run the enabled shadow policies, after the active mechanisms so both
+// see the same inputs of this tick.
+//
+static void
+dm_ShadowPolicyEvaluate(
+	IN	PADAPTER	Adapter)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_SHADOW_STAT		pStat;
+	ktime_t	Start;
+	u32	Shadow, Active, Diff, LatencyNs;
+	u8	i;
+
+	if((pdmext == NULL) || (pdmext->ShadowMask == 0))
+		return;
+
+	for(i = 0; i < DM_SHADOW_NUM; i++)
+	{
+		if(!(pdmext->ShadowMask & BIT(i)))
+			continue;
+		pStat = &pdmext->Shadow[i];
+
+		Start = ktime_get();
+		if(!DMShadowTable[i].Evaluate(Adapter, pStat, &Shadow, &Active))
+			continue;
+		LatencyNs = (u32)ktime_to_ns(ktime_sub(ktime_get(), Start));
+
+		pStat->LatencyNs += LatencyNs;
+		if(LatencyNs > pStat->MaxLatencyNs)
+			pStat->MaxLatencyNs = LatencyNs;
+
+		pStat->EvalCnt++;
+		pStat->LastShadow = Shadow;
+		pStat->LastActive = Active;
+		if(Shadow != Active)
+		{
+			Diff = (Shadow > Active) ? (Shadow - Active) : (Active - Shadow);
+			pStat->DivergeCnt++;
+			pStat->SumAbsDiff += Diff;
+			if(Diff > pStat->MaxAbsDiff)
+				pStat->MaxAbsDiff = Diff;
 		}
 	}
-#endif	
+}
+
+//
+// Description:
+//		Select the shadow policies to run, BIT(DM_SHADOW_ID) each. Their
+//		statistics restart.
+//
+static int
+dm_SetShadowPolicy(
+	IN	PADAPTER	Adapter,
+	IN	u32			Mask
+	)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+
+	if(pdmext == NULL)
+		return _FAIL;
+
+	pdmext->ShadowMask = Mask & (BIT(DM_SHADOW_NUM) - 1);
+	_rtw_memset(pdmext->Shadow, 0, sizeof(pdmext->Shadow));
+
+	return _SUCCESS;
 }
 
 static VOID
@@ -3750,6 +5994,7 @@ rtl8192c_dm_RF_Saving(
 	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(pAdapter);
 	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
 	PS_T	*pPSTable = &pdmpriv->DM_PSTable;
+	const DM_TUNING_PROFILE	*pProfile = GET_DM_PROFILE(pAdapter);
 
 	if(pdmpriv->initialize == 0){
 		pdmpriv->rf_saving_Reg874 = (PHY_QueryBBReg(pAdapter, rFPGA0_XCD_RFInterfaceSW, bMaskDWord)&0x1CC000)>>14;
@@ -3767,21 +6012,14 @@ rtl8192c_dm_RF_Saving(
 			 
 			if(pPSTable->PreRFState == RF_Normal)
 			{
-			#ifdef CONFIG_SPECIAL_SETTING_FOR_FUNAI_TV
-				if(pPSTable->Rssi_val_min >= 50)
-			#else
-				if(pPSTable->Rssi_val_min >= 30)
-			#endif
+				if(pPSTable->Rssi_val_min >= pProfile->RFSaveEnterRssi)
 					pPSTable->CurRFState = RF_Save;
 				else
 					pPSTable->CurRFState = RF_Normal;
 			}
 			else{
-			#ifdef CONFIG_SPECIAL_SETTING_FOR_FUNAI_TV
-				if(pPSTable->Rssi_val_min <= 45)
-			#else
-				if(pPSTable->Rssi_val_min <= 25)
-			#endif
+				if(pPSTable->Rssi_val_min <= (pProfile->RFSaveEnterRssi -
+					dm_RssiMargin(pAdapter, pProfile->RFSaveEnterRssi - pProfile->RFSaveLeaveRssi)))
 					pPSTable->CurRFState = RF_Normal;
 				else
 					pPSTable->CurRFState = RF_Save;
@@ -4276,7 +6514,8 @@ dm_SW_AntennaSwitch(
 			{	
 				//DBG_8192C("SWAS: TestMode = RSSI_MODE\n");
 				pDM_SWAT_Table->SelectAntennaMap=0xAA;
-				if(curRSSI < pDM_SWAT_Table->PreRSSI) //Current antenna is worse than previous antenna
+				// Current antenna is worse than previous antenna, by more than the RSSI spread
+				if((curRSSI + dm_RssiMargin(Adapter, 1)) <= pDM_SWAT_Table->PreRSSI)
 				{
 					//DBG_8192C("SWAS: Switch back to another antenna\n");
 					nextAntenna = (pDM_SWAT_Table->CurAntenna == Antenna_A)? Antenna_B : Antenna_A;
@@ -4401,128 +6640,642 @@ dm_SW_AntennaSwitch(
 		}
 	}
 
-//	RT_TRACE(COMP_SWAS, DBG_LOUD, ("SWAS: -----The End-----\n "));
+//	RT_TRACE(COMP_SWAS, DBG_LOUD, ("SWAS: -----The End-----\n "));
+
+}
+
+//
+// 20100514 Luke/Joseph:
+// Callback function for 500ms antenna test trying.
+//
+static void dm_SW_AntennaSwitchCallback(void *FunctionContext)
+{
+	_adapter *padapter = (_adapter *)FunctionContext;
+
+	if(padapter->net_closed == _TRUE)
+			return;
+	// Only 
+	dm_SW_AntennaSwitch(padapter, SWAW_STEP_DETERMINE);
+}
+
+
+//
+// 20100722
+// This function is used to gather the RSSI information for antenna testing.
+// It selects the RSSI of the peer STA that we want to know.
+//
+void SwAntDivRSSICheck8192C(_adapter *padapter ,u32 RxPWDBAll)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(padapter);	
+	struct mlme_priv	*pmlmepriv = &padapter->mlmepriv;
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+
+	SWAT_T	*pDM_SWAT_Table = &pdmpriv->DM_SWAT_Table;
+
+	if(IS_92C_SERIAL(pHalData->VersionID) ||pHalData->AntDivCfg==0)
+		return;
+	
+	if(check_fwstate(pmlmepriv, _FW_LINKED) == _TRUE)		
+	{			
+		if(pDM_SWAT_Table->CurAntenna == Antenna_A)
+		{			
+			pHalData->RSSI_sum_A += RxPWDBAll;
+			pHalData->RSSI_cnt_A++;
+		}
+		else
+		{
+			pHalData->RSSI_sum_B+= RxPWDBAll;
+			pHalData->RSSI_cnt_B++;
+		
+		}
+		//DBG_8192C("%s Ant_(%s),RSSI_sum(%d),RSSI_cnt(%d)\n",__FUNCTION__,(2==pHalData->CurAntenna)?"A":"B",pHalData->RSSI_sum,pHalData->RSSI_cnt);
+	}
+	
+}
+
+
+
+static VOID
+dm_SW_AntennaSwitchInit(
+	IN	PADAPTER	Adapter
+	)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	SWAT_T	*pDM_SWAT_Table = &pdmpriv->DM_SWAT_Table;
+
+	pHalData->RSSI_sum_A = 0;	
+	pHalData->RSSI_sum_B = 0;
+	pHalData->RSSI_cnt_A = 0;
+	pHalData->RSSI_cnt_B = 0;
+
+	pDM_SWAT_Table->CurAntenna = pHalData->CurAntenna;
+	pDM_SWAT_Table->PreAntenna = pHalData->CurAntenna;
+	pDM_SWAT_Table->try_flag = 0xff;
+	pDM_SWAT_Table->PreRSSI = 0;
+	pDM_SWAT_Table->bTriggerAntennaSwitch = 0;	
+	pDM_SWAT_Table->SelectAntennaMap=0xAA;
+	
+	// Move the timer initialization to InitializeVariables function.
+	//PlatformInitializeTimer(Adapter, &pMgntInfo->SwAntennaSwitchTimer, (RT_TIMER_CALL_BACK)dm_SW_AntennaSwitchCallback, NULL, "SwAntennaSwitchTimer");	
+}
+
+#endif
+
+//#define	RSSI_CCK	0
+//#define	RSSI_OFDM	1
+static void dm_RSSIMonitorInit(
+	IN	PADAPTER	Adapter
+)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	pdmpriv->OFDM_Pkt_Cnt = 0;
+	pdmpriv->RSSI_Select = RSSI_DEFAULT;
+}
+
+static void dm_RSSIMonitorCheck(
+	IN	PADAPTER	Adapter
+)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	struct mlme_priv *pmlmepriv = &Adapter->mlmepriv;
+
+	if(check_fwstate(pmlmepriv, _FW_LINKED) == _FALSE)
+		return;
+		
+	if(check_fwstate(pmlmepriv, WIFI_AP_STATE |WIFI_ADHOC_STATE) == _TRUE )
+	{
+		if(Adapter->stapriv.asoc_sta_count < 2)
+			return;			
+	}		
+	
+	if(pdmpriv->OFDM_Pkt_Cnt == 0)
+		pdmpriv->RSSI_Select = RSSI_CCK;
+	else
+		pdmpriv->RSSI_Select = RSSI_OFDM;
+
+	pdmpriv->OFDM_Pkt_Cnt = 0;	
+	//DBG_8192C("RSSI_Select=%s OFDM_Pkt_Cnt(%d)\n",
+		//(pdmpriv->RSSI_Select == RSSI_OFDM)?"RSSI_OFDM":"RSSI_CCK",
+		//pdmpriv->OFDM_Pkt_Cnt);
+}
+
+//============================================================
+// Telemetry ring
+//============================================================
+//
+// Orders an open of the debugfs file against dm_TelemetryFree(): the
+// file's i_private holds the ring only while the owner reference does.
+//
+static DEFINE_MUTEX(dm_telemetry_open_lock);
+
+static void
+dm_TelemetryRelease(
+	IN	struct kref	*Ref)
+{
+	PDM_TELEMETRY_RING	pRing = container_of(Ref, DM_TELEMETRY_RING, Ref);
+
+	vfree(pRing->pHdr);
+	rtw_mfree((u8 *)pRing, sizeof(DM_TELEMETRY_RING));
+}
+
+static void
+dm_TelemetryVmOpen(
+	IN	struct vm_area_struct	*vma)
+{
+	PDM_TELEMETRY_RING	pRing = vma->vm_private_data;
+
+	kref_get(&pRing->Ref);
+}
+
+static void
+dm_TelemetryVmClose(
+	IN	struct vm_area_struct	*vma)
+{
+	PDM_TELEMETRY_RING	pRing = vma->vm_private_data;
+
+	kref_put(&pRing->Ref, dm_TelemetryRelease);
+}
+
+static const struct vm_operations_struct dm_telemetry_vm_ops = {
+	.open	= dm_TelemetryVmOpen,
+	.close	= dm_TelemetryVmClose,
+};
+
+static int
+dm_TelemetryOpen(
+	IN	struct inode	*inode,
+	IN	struct file		*file)
+{
+	PDM_TELEMETRY_RING	pRing;
+
+	mutex_lock(&dm_telemetry_open_lock);
+	pRing = inode->i_private;
+	if(pRing)
+		kref_get(&pRing->Ref);
+	mutex_unlock(&dm_telemetry_open_lock);
+
+	if(pRing == NULL)
+		return -ENODEV;
+	file->private_data = pRing;
+
+	return 0;
+}
+
+static int
+dm_TelemetryClose(
+	IN	struct inode	*inode,
+	IN	struct file		*file)
+{
+	PDM_TELEMETRY_RING	pRing = file->private_data;
+
+	kref_put(&pRing->Ref, dm_TelemetryRelease);
+
+	return 0;
+}
+
+static int
+dm_TelemetryMmap(
+	IN	struct file				*file,
+	IN	struct vm_area_struct	*vma)
+{
+	PDM_TELEMETRY_RING	pRing = file->private_data;
+	int	ret;
+
+	if(vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	ret = remap_vmalloc_range(vma, pRing->pHdr, vma->vm_pgoff);
+	if(ret)
+		return ret;
+
+	vma->vm_private_data = pRing;
+	vma->vm_ops = &dm_telemetry_vm_ops;
+	kref_get(&pRing->Ref);
+
+	return 0;
+}
+
+static const struct file_operations dm_telemetry_fops = {
+	.owner		= THIS_MODULE,
+	.open		= dm_TelemetryOpen,
+	.release	= dm_TelemetryClose,
+	.mmap		= dm_TelemetryMmap,
+};
+
+static PDM_TELEMETRY_RING
+dm_TelemetryAlloc(void)
+{
+	PDM_TELEMETRY_RING	pRing;
+	u32	Size;
+
+	pRing = (PDM_TELEMETRY_RING)rtw_zmalloc(sizeof(DM_TELEMETRY_RING));
+	if(pRing == NULL)
+		return NULL;
+
+	Size = PAGE_ALIGN(sizeof(DM_TELEMETRY_HDR) +
+		sizeof(DM_TELEMETRY_REC) * DM_TELEMETRY_REC_NUM);
+	pRing->pHdr = (PDM_TELEMETRY_HDR)vmalloc_user(Size);
+	if(pRing->pHdr == NULL)
+	{
+		rtw_mfree((u8 *)pRing, sizeof(DM_TELEMETRY_RING));
+		return NULL;
+	}
+	pRing->pRec = (PDM_TELEMETRY_REC)(pRing->pHdr + 1);
+	pRing->Size = Size;
+	kref_init(&pRing->Ref);
+
+	pRing->pHdr->Magic = DM_TELEMETRY_MAGIC;
+	pRing->pHdr->Version = DM_TELEMETRY_VERSION;
+	pRing->pHdr->RecSize = sizeof(DM_TELEMETRY_REC);
+	pRing->pHdr->RecNum = DM_TELEMETRY_REC_NUM;
+
+	return pRing;
+}
+
+//
+// Description:
+//		Start or stop recording a telemetry record on each watchdog tick.
+//		The ring and its debugfs file are created on the first enable and
+//		kept until the DM is de-initialized, so existing mappings stay
+//		valid across a disable.
+//
+static int
+dm_TelemetryEnable(
+	IN	PADAPTER	Adapter,
+	IN	BOOLEAN		bEnable
+	)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	char	name[32];
+
+	if(pdmext == NULL)
+		return _FAIL;
+
+	if(bEnable && (pdmext->pTelemetry == NULL))
+	{
+		pdmext->pTelemetry = dm_TelemetryAlloc();
+		if(pdmext->pTelemetry == NULL)
+		{
+			DBG_8192C("%s: alloc telemetry ring fail!\n", __FUNCTION__);
+			return _FAIL;
+		}
+
+		snprintf(name, sizeof(name), "rtl8192c_dm-%s",
+			Adapter->pnetdev ? Adapter->pnetdev->name : "wlan");
+		pdmext->TelemetryDir = debugfs_create_dir(name, NULL);
+		if(!IS_ERR_OR_NULL(pdmext->TelemetryDir))
+			pdmext->TelemetryFile = debugfs_create_file("telemetry",
+				S_IRUSR | S_IRGRP, pdmext->TelemetryDir,
+				pdmext->pTelemetry, &dm_telemetry_fops);
+		if(IS_ERR_OR_NULL(pdmext->TelemetryFile))
+		{
+			DBG_8192C("%s: create debugfs %s fail!\n", __FUNCTION__, name);
+			if(!IS_ERR_OR_NULL(pdmext->TelemetryDir))
+				debugfs_remove_recursive(pdmext->TelemetryDir);
+			pdmext->TelemetryDir = NULL;
+			pdmext->TelemetryFile = NULL;
+			kref_put(&pdmext->pTelemetry->Ref, dm_TelemetryRelease);
+			pdmext->pTelemetry = NULL;
+			return _FAIL;
+		}
+	}
+
+	pdmext->bTelemetry = bEnable;
+
+	return _SUCCESS;
+}
+
+static void
+dm_TelemetryFree(
+	IN	struct dm_ext_priv	*pdmext)
+{
+	pdmext->bTelemetry = _FALSE;
+
+	if(pdmext->TelemetryDir)
+	{
+		// An open already past the VFS lookup pins the inode and must
+		// not take a reference once the owner one is gone.
+		mutex_lock(&dm_telemetry_open_lock);
+		pdmext->TelemetryFile->d_inode->i_private = NULL;
+		mutex_unlock(&dm_telemetry_open_lock);
+
+		debugfs_remove_recursive(pdmext->TelemetryDir);
+		pdmext->TelemetryDir = NULL;
+		pdmext->TelemetryFile = NULL;
+	}
+	if(pdmext->pTelemetry)
+	{
+		kref_put(&pdmext->pTelemetry->Ref, dm_TelemetryRelease);
+		pdmext->pTelemetry = NULL;
+	}
+}
+
+static void
+dm_TelemetryRecord(
+	IN	PADAPTER	Adapter,
+	IN	BOOLEAN		bDmRun)
+{
+	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
+	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	PFALSE_ALARM_STATISTICS FalseAlmCnt = &(pdmpriv->FalseAlmCnt);
+	DIG_T	*pDigTable = &pdmpriv->DM_DigTable;
+	PS_T	*pPSTable = &pdmpriv->DM_PSTable;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_TELEMETRY_HDR	pHdr;
+	PDM_TELEMETRY_REC	pRec;
+	u32	Head;
+
+	if((pdmext == NULL) || !pdmext->bTelemetry)
+		return;
+
+	pHdr = pdmext->pTelemetry->pHdr;
+	Head = pHdr->Head;
+	pRec = &pdmext->pTelemetry->pRec[Head % DM_TELEMETRY_REC_NUM];
+
+	pRec->Seq = (Head << 1) + 1;
+	smp_wmb();
+
+	pRec->TimeMs = jiffies_to_msecs(jiffies);
+	pRec->FaParity = FalseAlmCnt->Cnt_Parity_Fail;
+	pRec->FaRateIllegal = FalseAlmCnt->Cnt_Rate_Illegal;
+	pRec->FaCrc8 = FalseAlmCnt->Cnt_Crc8_fail;
+	pRec->FaMcs = FalseAlmCnt->Cnt_Mcs_fail;
+	pRec->FaFastFsync = FalseAlmCnt->Cnt_Fast_Fsync;
+	pRec->FaSbSearch = FalseAlmCnt->Cnt_SB_Search_fail;
+	pRec->FaOfdm = FalseAlmCnt->Cnt_Ofdm_fail;
+	pRec->FaCck = FalseAlmCnt->Cnt_Cck_fail;
+	pRec->FaAll = FalseAlmCnt->Cnt_all;
+	pRec->CurIGValue = pDigTable->CurIGValue;
+	pRec->CckPdState = pDigTable->CurCCKPDState;
+	pRec->PwdbMin = (u8)pdmpriv->EntryMinUndecoratedSmoothedPWDB;
+	pRec->PwdbMax = (u8)pdmpriv->EntryMaxUndecoratedSmoothedPWDB;
+	pRec->ThermalValue = pdmpriv->ThermalValue;
+	pRec->TxPowerLevel = pdmpriv->DynamicTxHighPowerLvl;
+	pRec->EdcaTurbo = pHalData->bCurrentTurboEDCA;
+	pRec->EdcaTrafficIdx = pdmpriv->prv_traffic_idx;
+	pRec->RFState = pPSTable->CurRFState;
+	pRec->CCAState = pPSTable->CurCCAState;
+	pRec->Flags = 0;
+	if(bDmRun)
+		pRec->Flags |= DM_TELEMETRY_FLAG_DM_RUN;
+	if(check_fwstate(&Adapter->mlmepriv, _FW_LINKED) == _TRUE)
+		pRec->Flags |= DM_TELEMETRY_FLAG_LINKED;
+
+	smp_wmb();
+	pRec->Seq = (Head << 1) + 2;
+	smp_wmb();
+	pHdr->Head = Head + 1;
+}
+
+//============================================================
+// DM thread
+//============================================================
+static VOID dm_WatchDog(IN PADAPTER Adapter);
+
+static int
+dm_ThreadFunc(
+	IN	void	*context)
+{
+	PADAPTER		Adapter = (PADAPTER)context;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_THREAD		pThread = &pdmext->Thread;
+	ktime_t			Start;
+	u32				LatencyUs, RunUs;
+
+	while(!kthread_should_stop())
+	{
+		set_current_state(TASK_INTERRUPTIBLE);
+		if(atomic_xchg(&pThread->Pending, 0) == 0)
+		{
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		Start = ktime_get();
+		LatencyUs = (u32)ktime_us_delta(Start, pThread->KickTime);
+
+		dm_WatchDog(Adapter);
+
+		RunUs = (u32)ktime_us_delta(ktime_get(), Start);
+
+		atomic_set(&pThread->Busy, 0);
+		complete(&pThread->Done);
+
+		pThread->RunCnt++;
+		pThread->LastLatencyUs = LatencyUs;
+		pThread->SumLatencyUs += LatencyUs;
+		if(LatencyUs > pThread->MaxLatencyUs)
+			pThread->MaxLatencyUs = LatencyUs;
+		pThread->LastRunUs = RunUs;
+		pThread->SumRunUs += RunUs;
+		if(RunUs > pThread->MaxRunUs)
+			pThread->MaxRunUs = RunUs;
+	}
+	__set_current_state(TASK_RUNNING);
+
+	// Release a kicker the stop raced with.
+	complete_all(&pThread->Done);
+
+	return 0;
+}
+
+static int
+dm_ThreadApplySched(
+	IN	PDM_THREAD	pThread)
+{
+	struct sched_param	param = { .sched_priority = 0 };
+	int	ret;
+
+	if(pThread->Policy == SCHED_NORMAL)
+	{
+		ret = sched_setscheduler(pThread->Task, SCHED_NORMAL, &param);
+		if(ret == 0)
+			set_user_nice(pThread->Task, pThread->Priority);
+	}
+	else
+	{
+		param.sched_priority = pThread->Priority;
+		ret = sched_setscheduler(pThread->Task, pThread->Policy, &param);
+	}
+	if(ret)
+		return ret;
+
+	if(pThread->Cpu == DM_THREAD_CPU_ANY)
+		return set_cpus_allowed_ptr(pThread->Task, cpu_possible_mask);
 
+	return set_cpus_allowed_ptr(pThread->Task, cpumask_of(pThread->Cpu));
 }
 
 //
-// 20100514 Luke/Joseph:
-// Callback function for 500ms antenna test trying.
+// Description:
+//		Run the DM of the adapter in a dedicated thread. Policy is
+//		SCHED_NORMAL (Priority is the nice value), SCHED_FIFO or SCHED_RR
+//		(Priority 1..MAX_RT_PRIO-1). Cpu pins the thread, DM_THREAD_CPU_ANY
+//		lets it float. Calling it again on a running thread changes the
+//		settings in place.
 //
-static void dm_SW_AntennaSwitchCallback(void *FunctionContext)
+static int
+rtl8192c_dm_ThreadStart(
+	IN	PADAPTER	Adapter,
+	IN	int			Policy,
+	IN	int			Priority,
+	IN	int			Cpu
+	)
 {
-	_adapter *padapter = (_adapter *)FunctionContext;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_THREAD		pThread;
+	struct task_struct	*Task;
+	_irqL	irqL;
+	int		ret = _SUCCESS;
 
-	if(padapter->net_closed == _TRUE)
-			return;
-	// Only 
-	dm_SW_AntennaSwitch(padapter, SWAW_STEP_DETERMINE);
-}
+	if(pdmext == NULL)
+		return _FAIL;
+	pThread = &pdmext->Thread;
 
+	switch(Policy)
+	{
+		case SCHED_NORMAL:
+			if((Priority < -20) || (Priority > 19))
+				return _FAIL;
+			break;
+		case SCHED_FIFO:
+		case SCHED_RR:
+			if((Priority < 1) || (Priority >= MAX_RT_PRIO))
+				return _FAIL;
+			break;
+		default:
+			return _FAIL;
+	}
+	if((Cpu != DM_THREAD_CPU_ANY) && ((Cpu < 0) || (Cpu >= nr_cpu_ids) || !cpu_online(Cpu)))
+		return _FAIL;
 
-//
-// 20100722
-// This function is used to gather the RSSI information for antenna testing.
-// It selects the RSSI of the peer STA that we want to know.
-//
-void SwAntDivRSSICheck8192C(_adapter *padapter ,u32 RxPWDBAll)
-{
-	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(padapter);	
-	struct mlme_priv	*pmlmepriv = &padapter->mlmepriv;
-	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	_enter_critical_mutex(&pThread->Lock, &irqL);
 
-	SWAT_T	*pDM_SWAT_Table = &pdmpriv->DM_SWAT_Table;
+	pThread->Policy = Policy;
+	pThread->Priority = Priority;
+	pThread->Cpu = Cpu;
 
-	if(IS_92C_SERIAL(pHalData->VersionID) ||pHalData->AntDivCfg==0)
-		return;
-	
-	if(check_fwstate(pmlmepriv, _FW_LINKED) == _TRUE)		
-	{			
-		if(pDM_SWAT_Table->CurAntenna == Antenna_A)
-		{			
-			pHalData->RSSI_sum_A += RxPWDBAll;
-			pHalData->RSSI_cnt_A++;
-		}
-		else
-		{
-			pHalData->RSSI_sum_B+= RxPWDBAll;
-			pHalData->RSSI_cnt_B++;
-		
-		}
-		//DBG_8192C("%s Ant_(%s),RSSI_sum(%d),RSSI_cnt(%d)\n",__FUNCTION__,(2==pHalData->CurAntenna)?"A":"B",pHalData->RSSI_sum,pHalData->RSSI_cnt);
+	if(pThread->Task)
+	{
+		if(dm_ThreadApplySched(pThread))
+			ret = _FAIL;
+		goto exit;
 	}
-	
-}
 
+	atomic_set(&pThread->Pending, 0);
+	atomic_set(&pThread->Busy, 0);
+	INIT_COMPLETION(pThread->Done);
+	Task = kthread_create(dm_ThreadFunc, Adapter, "rtw_dm/%s",
+		Adapter->pnetdev ? Adapter->pnetdev->name : "wlan");
+	if(IS_ERR(Task))
+	{
+		DBG_8192C("%s: kthread_create fail %ld\n", __FUNCTION__, PTR_ERR(Task));
+		ret = _FAIL;
+		goto exit;
+	}
+	pThread->Task = Task;
 
+	if(dm_ThreadApplySched(pThread))
+	{
+		DBG_8192C("%s: apply policy %d prio %d cpu %d fail\n", __FUNCTION__,
+			Policy, Priority, Cpu);
+		kthread_stop(Task);
+		pThread->Task = NULL;
+		ret = _FAIL;
+		goto exit;
+	}
 
-static VOID
-dm_SW_AntennaSwitchInit(
-	IN	PADAPTER	Adapter
-	)
-{
-	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
-	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
-	SWAT_T	*pDM_SWAT_Table = &pdmpriv->DM_SWAT_Table;
+	wake_up_process(Task);
 
-	pHalData->RSSI_sum_A = 0;	
-	pHalData->RSSI_sum_B = 0;
-	pHalData->RSSI_cnt_A = 0;
-	pHalData->RSSI_cnt_B = 0;
+exit:
+	_exit_critical_mutex(&pThread->Lock, &irqL);
 
-	pDM_SWAT_Table->CurAntenna = pHalData->CurAntenna;
-	pDM_SWAT_Table->PreAntenna = pHalData->CurAntenna;
-	pDM_SWAT_Table->try_flag = 0xff;
-	pDM_SWAT_Table->PreRSSI = 0;
-	pDM_SWAT_Table->bTriggerAntennaSwitch = 0;	
-	pDM_SWAT_Table->SelectAntennaMap=0xAA;
-	
-	// Move the timer initialization to InitializeVariables function.
-	//PlatformInitializeTimer(Adapter, &pMgntInfo->SwAntennaSwitchTimer, (RT_TIMER_CALL_BACK)dm_SW_AntennaSwitchCallback, NULL, "SwAntennaSwitchTimer");	
+	return ret;
 }
 
-#endif
-
-//#define	RSSI_CCK	0
-//#define	RSSI_OFDM	1
-static void dm_RSSIMonitorInit(
+//
+// Description:
+//		Stop the DM thread; the DM runs in the caller of
+//		rtl8192c_HalDmWatchDog() again. Waits for a tick in progress.
+//
+static void
+rtl8192c_dm_ThreadStop(
 	IN	PADAPTER	Adapter
-)
+	)
 {
-	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
-	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
-	pdmpriv->OFDM_Pkt_Cnt = 0;
-	pdmpriv->RSSI_Select = RSSI_DEFAULT;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	struct task_struct	*Task;
+	_irqL	irqL;
+
+	if(pdmext == NULL)
+		return;
+
+	_enter_critical_mutex(&pdmext->Thread.Lock, &irqL);
+	Task = pdmext->Thread.Task;
+	pdmext->Thread.Task = NULL;
+	_exit_critical_mutex(&pdmext->Thread.Lock, &irqL);
+
+	if(Task)
+		kthread_stop(Task);
 }
 
-static void dm_RSSIMonitorCheck(
-	IN	PADAPTER	Adapter
-)
+//
+// Hand the watchdog tick to the DM thread and wait for it to be done.
+// Returns _FALSE if there is no thread and the caller has to run the DM
+// itself.
+//
+static BOOLEAN
+dm_ThreadKick(
+	IN	PADAPTER	Adapter)
 {
-	HAL_DATA_TYPE	*pHalData = GET_HAL_DATA(Adapter);
-	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
-	struct mlme_priv *pmlmepriv = &Adapter->mlmepriv;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_THREAD		pThread;
+	_irqL	irqL;
 
-	if(check_fwstate(pmlmepriv, _FW_LINKED) == _FALSE)
-		return;
-		
-	if(check_fwstate(pmlmepriv, WIFI_AP_STATE |WIFI_ADHOC_STATE) == _TRUE )
+	if(pdmext == NULL)
+		return _FALSE;
+	pThread = &pdmext->Thread;
+
+	_enter_critical_mutex(&pThread->Lock, &irqL);
+	if(pThread->Task == NULL)
 	{
-		if(Adapter->stapriv.asoc_sta_count < 2)
-			return;			
-	}		
-	
-	if(pdmpriv->OFDM_Pkt_Cnt == 0)
-		pdmpriv->RSSI_Select = RSSI_CCK;
-	else
-		pdmpriv->RSSI_Select = RSSI_OFDM;
+		_exit_critical_mutex(&pThread->Lock, &irqL);
+		return _FALSE;
+	}
 
-	pdmpriv->OFDM_Pkt_Cnt = 0;	
-	//DBG_8192C("RSSI_Select=%s OFDM_Pkt_Cnt(%d)\n",
-		//(pdmpriv->RSSI_Select == RSSI_OFDM)?"RSSI_OFDM":"RSSI_CCK",
-		//pdmpriv->OFDM_Pkt_Cnt);
+	// Only one tick at a time, an overrun one is not queued behind.
+	if(atomic_read(&pThread->Busy))
+	{
+		pThread->SkipCnt++;
+		_exit_critical_mutex(&pThread->Lock, &irqL);
+		return _TRUE;
+	}
+
+	pThread->KickCnt++;
+	INIT_COMPLETION(pThread->Done);
+	pThread->KickTime = ktime_get();
+	atomic_set(&pThread->Busy, 1);
+	atomic_set(&pThread->Pending, 1);
+	wake_up_process(pThread->Task);
+
+	// Stop takes the lock, so the wait is done without it.
+	_exit_critical_mutex(&pThread->Lock, &irqL);
+
+	if(!wait_for_completion_timeout(&pThread->Done,
+			msecs_to_jiffies(DM_THREAD_KICK_TIMEOUT_MS)))
+		pThread->TimeoutCnt++;
+
+	return _TRUE;
 }
 
+static void dm_ProcRegister(IN PADAPTER Adapter);
+static void dm_ProcUnregister(IN struct dm_ext_priv *pdmext);
+
 //============================================================
 // functions
 //============================================================
@@ -4530,9 +7283,32 @@ void rtl8192c_init_dm_priv(IN PADAPTER Adapter)
 {
 	PHAL_DATA_TYPE	pHalData = GET_HAL_DATA(Adapter);
 	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	struct dm_ext_priv	*pdmext;
+	unsigned long	flags;
 
 	//_rtw_memset(pdmpriv, 0, sizeof(struct dm_priv));
 
+	if(GET_DM_EXT(Adapter) == NULL)
+	{
+		pdmext = (struct dm_ext_priv *)rtw_zmalloc(sizeof(struct dm_ext_priv));
+		if(pdmext == NULL)
+		{
+			DBG_8192C("%s: alloc dm_ext_priv fail!\n", __FUNCTION__);
+		}
+		else
+		{
+			pdmext->padapter = Adapter;
+			dm_ExtInitDefault(pdmext);
+			dm_FASampleInit(&pdmext->FaSample);
+			_rtw_mutex_init(&pdmext->Thread.Lock);
+			init_completion(&pdmext->Thread.Done);
+
+			spin_lock_irqsave(&dm_ext_lock, flags);
+			rtw_list_insert_tail(&pdmext->List, &dm_ext_list);
+			spin_unlock_irqrestore(&dm_ext_lock, flags);
+		}
+	}
+
 #ifdef CONFIG_SW_ANTENNA_DIVERSITY
 	_init_timer(&(pdmpriv->SwAntennaSwitchTimer),  Adapter->pnetdev , dm_SW_AntennaSwitchCallback, Adapter);
 #endif
@@ -4542,10 +7318,30 @@ void rtl8192c_deinit_dm_priv(IN PADAPTER Adapter)
 {
 	PHAL_DATA_TYPE	pHalData = GET_HAL_DATA(Adapter);
 	struct dm_priv	*pdmpriv = &pHalData->dmpriv;
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	unsigned long	flags;
 
 #ifdef CONFIG_SW_ANTENNA_DIVERSITY
 	_cancel_timer_ex(&pdmpriv->SwAntennaSwitchTimer);
 #endif
+
+	rtl8192c_dm_ThreadStop(Adapter);
+
+	if(pdmext == NULL)
+		return;
+
+	// Called on driver removal, after the xmit/recv/cmd threads are gone.
+	dm_ProcUnregister(pdmext);
+	dm_TelemetryFree(pdmext);
+	_rtw_mutex_free(&pdmext->Thread.Lock);
+
+	spin_lock_irqsave(&dm_ext_lock, flags);
+	rtw_list_delete(&pdmext->List);
+	spin_unlock_irqrestore(&dm_ext_lock, flags);
+
+	if(pdmext->pTxPwrImg)
+		rtw_vmfree((u8 *)pdmext->pTxPwrImg, sizeof(DM_TXPWR_IMG_CACHE));
+	rtw_mfree((u8 *)pdmext, sizeof(struct dm_ext_priv));
 }
 #ifdef CONFIG_HW_ANTENNA_DIVERSITY
 void dm_InitHybridAntDiv(IN PADAPTER Adapter)
@@ -4700,6 +7496,12 @@ rtl8192c_InitHalDm(
 
 	dm_RSSIMonitorInit(Adapter);
 
+	// BB was just (re)configured, HSSI images are re-captured on first use.
+	rtl8192c_dm_RFShadowInvalidate(Adapter);
+	rtl8192c_dm_TxPowerImageInvalidate(Adapter);
+
+	dm_InitAmpduCtrl(Adapter);
+
 	pdmpriv->DMFlag_tmp = pdmpriv->DMFlag;
 
 	// Save REG_INIDATA_RATE_SEL value for TXDESC.
@@ -4780,8 +7582,8 @@ static void FindMinimumRSSI(PADAPTER Adapter)
 
 #endif //CONFIG_CONCURRENT_MODE
 
-VOID
-rtl8192c_HalDmWatchDog(
+static VOID
+dm_WatchDog(
 	IN	PADAPTER	Adapter
 	)
 {
@@ -4875,6 +7677,11 @@ rtl8192c_HalDmWatchDog(
 		//
 		dm_DynamicTxPower(Adapter);
 
+		//
+		// Alternate policies on the same inputs, no register I/O.
+		//
+		dm_ShadowPolicyEvaluate(Adapter);
+
 		//
 		// Tx Power Tracking.
 		//
@@ -4890,6 +7697,16 @@ rtl8192c_HalDmWatchDog(
 		//
 		dm_RefreshRateAdaptiveMask(Adapter);
 
+		//
+		// Link degradation predictor, for roaming ahead of beacon loss.
+		//
+		dm_LinkPredict(Adapter);
+
+		//
+		// A-MPDU size and density by link quality.
+		//
+		dm_DynamicAmpdu(Adapter);
+
 #ifdef CONFIG_BT_COEXIST
 		//BT-Coexist
 		dm_BTCoexist(Adapter);
@@ -4954,10 +7771,18 @@ _record_initrate:
 				pdmpriv->INIDATA_RATE[i] = rtw_read8(Adapter, (REG_INIDATA_RATE_SEL+i)) & 0x3f;
 			}
 		}
+
+		//
+		// SoftAP channel survey, one channel per tick while idle.
+		//
+		dm_AcsStep(Adapter);
 	}
 
 skip_dm:
 
+	dm_TelemetryRecord(Adapter, (hw_init_completed == _TRUE) &&
+		(!bFwCurrentInPSMode) && bFwPSAwake);
+
 	// Check GPIO to determine current RF on/off and Pbc status.
 	// Check Hardware Radio ON/OFF or not	
 	//if(Adapter->MgntInfo.PowerSaveControl.bGpioRfSw)
@@ -4975,3 +7800,362 @@ skip_dm:
 
 }
 
+VOID
+rtl8192c_HalDmWatchDog(
+	IN	PADAPTER	Adapter
+	)
+{
+	// The interface name is only final once the netdev is registered.
+	dm_ProcRegister(Adapter);
+
+	// Deferred to the DM thread when one is running.
+	if(dm_ThreadKick(Adapter) == _TRUE)
+		return;
+
+	dm_WatchDog(Adapter);
+}
+
+
+//
+// Description:
+//		Dump the statistics of the DM extension mechanisms, for the proc
+//		interface. Returns the number of bytes written into page.
+//
+static int
+rtl8192c_dm_proc_get_ext(
+	IN	PADAPTER	Adapter,
+	IN	char		*page,
+	IN	int			count
+	)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	PDM_RF_SHADOW		pShadow;
+	PDM_SHADOW_STAT		pShadowStat;
+	_irqL				irqL;
+	int					len = 0;
+	u8					i;
+
+	if(pdmext == NULL)
+		return 0;
+
+	len += scnprintf(page + len, count - len, "DM profile: %s\n", pdmext->Profile.Name);
+
+	pShadow = &pdmext->RFShadow;
+	len += scnprintf(page + len, count - len,
+		"RF shadow: trigger=%u trigger_skip=%u fast_read=%u write_skip=%u saved_io=%u\n",
+		pShadow->TriggerCnt, pShadow->TriggerSkipCnt, pShadow->FastReadCnt,
+		pShadow->WriteSkipCnt, pShadow->SavedIOCnt);
+
+	if(pdmext->EdcaAP.bActive)
+	{
+		len += scnprintf(page + len, count - len,
+			"EDCA AP: dir=%u ticks idle=%u balanced=%u ul=%u dl=%u load on/off ul=%+d%% dl=%+d%%\n",
+			pdmext->EdcaAP.Dir, pdmext->EdcaAP.DirTicks[DM_EDCA_AP_IDLE],
+			pdmext->EdcaAP.DirTicks[DM_EDCA_AP_BALANCED], pdmext->EdcaAP.DirTicks[DM_EDCA_AP_UPLINK],
+			pdmext->EdcaAP.DirTicks[DM_EDCA_AP_DOWNLINK],
+			dm_EdcaAPLoadDelta(&pdmext->EdcaAP, DM_EDCA_AP_UPLINK),
+			dm_EdcaAPLoadDelta(&pdmext->EdcaAP, DM_EDCA_AP_DOWNLINK));
+	}
+
+	len += scnprintf(page + len, count - len,
+		"TX power image: hit=%u miss=%u\n",
+		pdmext->TxPwrImgHitCnt, pdmext->TxPwrImgMissCnt);
+
+
+	len += scnprintf(page + len, count - len,
+		"A-MPDU: level=%u agglen=0x%08x/0x%08x min_space=%u/%u changes=%u\n",
+		pdmext->Ampdu.Level, pdmext->Ampdu.CurAggLen, pdmext->Ampdu.BaseAggLen,
+		pdmext->Ampdu.CurMinSpace, pdmext->Ampdu.BaseMinSpace, pdmext->Ampdu.LevelChangeCnt);
+	len += scnprintf(page + len, count - len,
+		" level ticks: large=%u mid=%u small=%u\n",
+		pdmext->Ampdu.LevelTicks[DM_AMPDU_LEVEL_LARGE],
+		pdmext->Ampdu.LevelTicks[DM_AMPDU_LEVEL_MID],
+		pdmext->Ampdu.LevelTicks[DM_AMPDU_LEVEL_SMALL]);
+
+	len += scnprintf(page + len, count - len,
+		"DIG weighted PWDB: percentile=%u pwdb=%d used=%u fallback=%u\n",
+		pdmext->DigWeight.Percentile, pdmext->DigWeight.WeightedPWDB,
+		pdmext->DigWeight.UsedCnt, pdmext->DigWeight.FallbackCnt);
+
+	for(i = 0; i < DM_SHADOW_NUM; i++)
+	{
+		if(DM_PROC_FULL(len, count))
+			break;
+		if(!(pdmext->ShadowMask & BIT(i)))
+			continue;
+		pShadowStat = &pdmext->Shadow[i];
+		len += scnprintf(page + len, count - len,
+			"Shadow %s: eval=%u diverge=%u shadow=%u active=%u sum_diff=%u max_diff=%u lat_ns=%llu max_lat_ns=%u\n",
+			DMShadowTable[i].Name, pShadowStat->EvalCnt, pShadowStat->DivergeCnt,
+			pShadowStat->LastShadow, pShadowStat->LastActive, pShadowStat->SumAbsDiff,
+			pShadowStat->MaxAbsDiff, (unsigned long long)pShadowStat->LatencyNs, pShadowStat->MaxLatencyNs);
+	}
+
+	if(pdmext->Acs.SurveyCnt || pdmext->Acs.bRunning)
+	{
+		len += scnprintf(page + len, count - len,
+			"ACS: best=%u running=%u surveys=%u restarts=%u last_ms=%u dwell_ms=%u period_s=%u\n",
+			pdmext->Acs.BestChannel, pdmext->Acs.bRunning, pdmext->Acs.SurveyCnt,
+			pdmext->Acs.RestartCnt, pdmext->Acs.SurveyMs,
+			pdmext->Acs.DwellMs, pdmext->Acs.PeriodSec);
+		for(i = 0; i < DM_ACS_CH_NUM; i++)
+		{
+			if(DM_PROC_FULL(len, count))
+				break;
+			if(!(pdmext->Acs.ChannelMask & BIT(i)))
+				continue;
+			len += scnprintf(page + len, count - len,
+				" ch=%u usable=%u fa_busy=%u bss_busy=%u bss=%u overlap=%u max_rssi=%d ofdm_fa_s=%u cck_fa_s=%u"
+				" parity=%u rate=%u crc8=%u mcs=%u fsync=%u sb=%u\n",
+				i + 1, pdmext->Acs.Ch[i].Usable, pdmext->Acs.Ch[i].FaBusy,
+				pdmext->Acs.Ch[i].BssBusy, pdmext->Acs.Ch[i].BssCnt, pdmext->Acs.Ch[i].OverlapCnt,
+				pdmext->Acs.Ch[i].MaxRssi, pdmext->Acs.Ch[i].OfdmFAPerSec, pdmext->Acs.Ch[i].CckFAPerSec,
+				pdmext->Acs.Ch[i].FaParity, pdmext->Acs.Ch[i].FaRateIllegal, pdmext->Acs.Ch[i].FaCrc8,
+				pdmext->Acs.Ch[i].FaMcs, pdmext->Acs.Ch[i].FaFastFsync, pdmext->Acs.Ch[i].FaSbSearch);
+		}
+	}
+
+	len += scnprintf(page + len, count - len,
+		"FA rate: interval_ms=%u per_sec all=%u ofdm=%u cck=%u saturated=%u\n",
+		pdmext->FaSample.IntervalMs, pdmext->FaSample.AllPerSec,
+		pdmext->FaSample.OfdmPerSec, pdmext->FaSample.CckPerSec,
+		pdmext->FaSample.SatCnt);
+
+	len += scnprintf(page + len, count - len,
+		"RSSI estimator: confidence=%u ref_macid=%u adaptive=%u fixed=%u\n",
+		pdmext->RssiStat.Confidence, pdmext->RssiStat.RefMacId,
+		pdmext->RssiStat.AdaptCnt, pdmext->RssiStat.FixedCnt);
+	for(i = 0; i < DM_RSSI_EST_MACID_NUM; i++)
+	{
+		if(DM_PROC_FULL(len, count))
+			break;
+		if(pdmext->RssiStat.Sta[i].Samples == 0)
+			continue;
+		len += scnprintf(page + len, count - len,
+			" macid=%u mean_x16=%d sigma_x16=%lu samples=%u\n",
+			i, pdmext->RssiStat.Sta[i].MeanQ4,
+			int_sqrt(pdmext->RssiStat.Sta[i].VarQ8), pdmext->RssiStat.Sta[i].Samples);
+	}
+
+	len += scnprintf(page + len, count - len,
+		"Link predict: score=%u events=%u drops=%u other_ends=%u predicted=%u false_alarm=%u\n",
+		pdmext->LinkPredict.Score, pdmext->LinkPredict.EventCnt,
+		pdmext->LinkPredict.DropCnt, pdmext->LinkPredict.OtherEndCnt,
+		pdmext->LinkPredict.PredictedDropCnt,
+		pdmext->LinkPredict.FalseAlarmCnt);
+	len += scnprintf(page + len, count - len,
+		" lead_ms: last=%u min=%u max=%u avg=%u\n",
+		pdmext->LinkPredict.LastLeadMs, pdmext->LinkPredict.MinLeadMs,
+		pdmext->LinkPredict.MaxLeadMs,
+		(pdmext->LinkPredict.PredictedDropCnt) ?
+			(pdmext->LinkPredict.SumLeadMs / pdmext->LinkPredict.PredictedDropCnt) : 0);
+
+	_enter_critical_mutex(&pdmext->Thread.Lock, &irqL);
+	if(pdmext->Thread.Task)
+	{
+		len += scnprintf(page + len, count - len,
+			"DM thread: pid=%d policy=%d prio=%d cpu=%d kick=%u run=%u timeout=%u skip=%u\n",
+			task_pid_nr(pdmext->Thread.Task), pdmext->Thread.Policy,
+			pdmext->Thread.Priority, pdmext->Thread.Cpu,
+			pdmext->Thread.KickCnt, pdmext->Thread.RunCnt,
+			pdmext->Thread.TimeoutCnt, pdmext->Thread.SkipCnt);
+		len += scnprintf(page + len, count - len,
+			" latency_us: last=%u max=%u avg=%llu run_us: last=%u max=%u avg=%llu\n",
+			pdmext->Thread.LastLatencyUs, pdmext->Thread.MaxLatencyUs,
+			(pdmext->Thread.RunCnt) ?
+				div_u64(pdmext->Thread.SumLatencyUs, pdmext->Thread.RunCnt) : 0ULL,
+			pdmext->Thread.LastRunUs, pdmext->Thread.MaxRunUs,
+			(pdmext->Thread.RunCnt) ?
+				div_u64(pdmext->Thread.SumRunUs, pdmext->Thread.RunCnt) : 0ULL);
+	}
+	_exit_critical_mutex(&pdmext->Thread.Lock, &irqL);
+
+
+	return len;
+}
+
+//
+// Description:
+//		Run-time settings of the DM extension mechanisms, for the proc
+//		interface. Buffer holds one "<setting> <value>" line, e.g.
+//		"profile tv", "shadow 0x3", "telemetry 1", "dig_percentile 80",
+//		"rssi_confidence 15" (sigma x10, 0 for the fixed gaps),
+//		"acs_survey 100" (dwell ms), "acs_period 60" (s, 0 to stop) or
+//		"dm_thread fifo:10:1" (policy normal/fifo/rr, priority and CPU
+//		optional, "off" to stop).
+//		Returns _FAIL on an unknown setting or value.
+//
+static int
+rtl8192c_dm_proc_set_ext(
+	IN	PADAPTER	Adapter,
+	IN	const char	*buffer,
+	IN	int			count
+	)
+{
+	char	tmp[48];
+	char	Cmd[16], Arg[16];
+	char	Policy[8];
+	int		Priority = 0, Cpu = DM_THREAD_CPU_ANY;
+	u32		Val;
+
+	if((count < 1) || (count >= sizeof(tmp)))
+		return _FAIL;
+
+	_rtw_memcpy(tmp, buffer, count);
+	tmp[count] = '\0';
+
+	if(sscanf(tmp, "%15s %15s", Cmd, Arg) != 2)
+		return _FAIL;
+
+	if(strcmp(Cmd, "profile") == 0)
+		return dm_SetProfileByName(Adapter, Arg);
+
+	if(strcmp(Cmd, "shadow") == 0)
+	{
+		if(kstrtou32(Arg, 0, &Val))
+			return _FAIL;
+		return dm_SetShadowPolicy(Adapter, Val);
+	}
+
+	if(strcmp(Cmd, "acs_survey") == 0)
+	{
+		if(kstrtou32(Arg, 0, &Val) || (Val > DM_ACS_DWELL_MS_MAX))
+			return _FAIL;
+		return dm_AcsStart(Adapter, (u16)Val, 0);
+	}
+
+	if(strcmp(Cmd, "acs_period") == 0)
+	{
+		if(kstrtou32(Arg, 0, &Val))
+			return _FAIL;
+		if(Val == 0)
+		{
+			dm_AcsStop(Adapter);
+			return _SUCCESS;
+		}
+		return dm_AcsStart(Adapter, 0, Val);
+	}
+
+	if(strcmp(Cmd, "telemetry") == 0)
+	{
+		if(kstrtou32(Arg, 0, &Val) || (Val > 1))
+			return _FAIL;
+		return dm_TelemetryEnable(Adapter, Val ? _TRUE : _FALSE);
+	}
+
+	if(strcmp(Cmd, "dig_percentile") == 0)
+	{
+		if(kstrtou32(Arg, 0, &Val) || (Val > 100))
+			return _FAIL;
+		return dm_SetDIGWeightedPercentile(Adapter, (u8)Val);
+	}
+
+	if(strcmp(Cmd, "rssi_confidence") == 0)
+	{
+		if(kstrtou32(Arg, 0, &Val) || (Val > 0xff))
+			return _FAIL;
+		return dm_SetRssiConfidence(Adapter, (u8)Val);
+	}
+
+	if(strcmp(Cmd, "dm_thread") == 0)
+	{
+		if(strcmp(Arg, "off") == 0)
+		{
+			rtl8192c_dm_ThreadStop(Adapter);
+			return _SUCCESS;
+		}
+		if(sscanf(Arg, "%7[a-z]:%d:%d", Policy, &Priority, &Cpu) < 1)
+			return _FAIL;
+		if(strcmp(Policy, "normal") == 0)
+			return rtl8192c_dm_ThreadStart(Adapter, SCHED_NORMAL, Priority, Cpu);
+		if(Priority == 0)
+			Priority = 1;
+		if(strcmp(Policy, "fifo") == 0)
+			return rtl8192c_dm_ThreadStart(Adapter, SCHED_FIFO, Priority, Cpu);
+		if(strcmp(Policy, "rr") == 0)
+			return rtl8192c_dm_ThreadStart(Adapter, SCHED_RR, Priority, Cpu);
+		return _FAIL;
+	}
+
+	return _FAIL;
+}
+
+static int
+dm_ProcRead(
+	char	*page,
+	char	**start,
+	off_t	off,
+	int		count,
+	int		*eof,
+	void	*data)
+{
+	*eof = 1;
+	if(off > 0)
+		return 0;
+
+	return rtl8192c_dm_proc_get_ext((PADAPTER)data, page, count);
+}
+
+static int
+dm_ProcWrite(
+	struct file			*file,
+	const char __user	*buffer,
+	unsigned long		count,
+	void				*data)
+{
+	char	tmp[48];
+
+	if((count < 1) || (count >= sizeof(tmp)))
+		return -EINVAL;
+
+	if(copy_from_user(tmp, buffer, count))
+		return -EFAULT;
+
+	if(rtl8192c_dm_proc_set_ext((PADAPTER)data, tmp, count) != _SUCCESS)
+		return -EINVAL;
+
+	return count;
+}
+
+//
+// Description:
+//		Create /proc/net/rtl8192c_dm-<ifname> on the first watchdog tick.
+//		A failed create is not retried.
+//
+static void
+dm_ProcRegister(
+	IN	PADAPTER	Adapter
+	)
+{
+	struct dm_ext_priv	*pdmext = GET_DM_EXT(Adapter);
+	struct proc_dir_entry	*entry;
+
+	if((pdmext == NULL) || (pdmext->ProcName[0] != '\0') || (Adapter->pnetdev == NULL))
+		return;
+
+	snprintf(pdmext->ProcName, sizeof(pdmext->ProcName), "rtl8192c_dm-%s",
+		Adapter->pnetdev->name);
+
+	entry = create_proc_entry(pdmext->ProcName, S_IFREG | S_IRUGO | S_IWUSR, init_net.proc_net);
+	if(entry == NULL)
+	{
+		DBG_8192C("%s: create proc %s fail!\n", __FUNCTION__, pdmext->ProcName);
+		return;
+	}
+
+	entry->data = Adapter;
+	entry->read_proc = dm_ProcRead;
+	entry->write_proc = dm_ProcWrite;
+	pdmext->ProcEntry = entry;
+}
+
+static void
+dm_ProcUnregister(
+	IN	struct dm_ext_priv	*pdmext)
+{
+	if(pdmext->ProcEntry)
+	{
+		remove_proc_entry(pdmext->ProcName, init_net.proc_net);
+		pdmext->ProcEntry = NULL;
+	}
+}